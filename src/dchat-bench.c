@@ -0,0 +1,1412 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Load-generating stand-in for the DChat core.
+ * Serves the UI unix sockets, runs dchat-gui within a pseudo terminal,
+ * floods it with messages and reports the throughput, the CPU time
+ * per message and the peak RSS of the GUI. Instead of generated
+ * messages, a trace captured by dchat-gui (see ENV_CAPTURE) can be
+ * replayed. The line reader of the UI sockets can be measured on its
+ * own, without running the GUI.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <termios.h>
+#include <ncurses.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <linux/sockios.h>
+
+#include "dchat-gui.h"
+#include "dchat-bench.h"
+
+
+int
+main(int argc, char** argv)
+{
+    BENCH_T b;
+    struct rusage ru;
+    pthread_t th_pty;
+    long long start, end;
+    double cpu;
+
+    if (parse_opts(&b.opt, argc, argv) == -1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (b.opt.reader)
+    {
+        return bench_reader(&b) == -1 ? 1 : 0;
+    }
+
+    if (init_bench(&b) == -1 || spawn_gui(&b) == -1)
+    {
+        perror("dchat-bench");
+        free_bench(&b);
+        return 1;
+    }
+
+    // the GUI blocks if its terminal output is not read
+    if (!b.opt.headless)
+    {
+        pthread_create(&th_pty, NULL, th_drain_pty, &b);
+    }
+
+    // a replayed trace contains the nickname sent by the core
+    if ((b.opt.trace != NULL ? accept_socks(&b) : accept_gui(&b)) == -1)
+    {
+        fprintf(stderr, "dchat-bench: GUI did not connect\n");
+        quit_gui(&b, &ru);
+        free_bench(&b);
+        return 1;
+    }
+
+    start = bench_now_us();
+
+    if ((b.opt.trace != NULL ? replay_trace(&b) : send_load(&b)) == -1)
+    {
+        perror("dchat-bench");
+        quit_gui(&b, &ru);
+        free_bench(&b);
+        return 1;
+    }
+
+    wait_consumed(&b);
+    wait_idle(&b);
+    end = bench_now_us() - BENCH_IDLE * 1000;
+
+    for (int i = 0; i < b.opt.restarts; i++)
+    {
+        if ((b.reconnect[i] = restart_core(&b)) == -1)
+        {
+            fprintf(stderr, "dchat-bench: GUI did not reconnect\n");
+            quit_gui(&b, &ru);
+            free_bench(&b);
+            return 1;
+        }
+    }
+
+    quit_gui(&b, &ru);
+
+    if (!b.opt.headless)
+    {
+        pthread_join(th_pty, NULL);
+    }
+    cpu = ru.ru_utime.tv_sec * 1e6 + ru.ru_utime.tv_usec +
+          ru.ru_stime.tv_sec * 1e6 + ru.ru_stime.tv_usec;
+
+    if (b.opt.trace != NULL)
+    {
+        // messages of a trace are only counted by the GUI, see its statistics
+        printf("records:         %ld\n", b.replayed);
+        printf("bytes:           %lld\n", b.bytes);
+        printf("trace duration:  %.3f s\n", b.trace_ns / 1e9);
+        printf("elapsed:         %.3f s\n", (end - start) / 1e6);
+        printf("cpu:             %.3f s (user %.1f s, sys %.1f s)\n", cpu / 1e6,
+               ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+               ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+    }
+    else
+    {
+        printf("messages:        %ld (input %ld, logging %ld, presence %ld)\n",
+               b.sent_inp + b.sent_log, b.sent_inp - b.sent_pres, b.sent_log,
+               b.sent_pres);
+        printf("bytes:           %lld\n", b.bytes);
+        printf("elapsed:         %.3f s\n", (end - start) / 1e6);
+        printf("throughput:      %.0f msg/s\n",
+               (b.sent_inp + b.sent_log) / ((end - start) / 1e6));
+        printf("cpu per message: %.2f us (user %.1f s, sys %.1f s)\n",
+               cpu / (b.sent_inp + b.sent_log),
+               ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+               ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+    }
+
+    printf("peak rss:        %ld KB\n", ru.ru_maxrss);
+    print_reconnects(&b);
+    print_stats(&b);
+    free_bench(&b);
+    return 0;
+}
+
+
+/**
+ * Prints the usage of the benchmark.
+ * @param prog Name of the executable
+ */
+void
+usage(char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -g <path>   GUI executable (default: ./dchat-gui)\n"
+            "  -n <count>  number of messages (default: 100000)\n"
+            "  -r <rate>   messages per second, 0 = maximum (default: 0)\n"
+            "  -s <min>    minimum message length (default: 20)\n"
+            "  -S <max>    maximum message length (default: 200)\n"
+            "  -u <nicks>  number of distinct nicknames (default: 50)\n"
+            "  -z <exp>    zipf exponent of nicknames, 0 = uniform (default: 1.0)\n"
+            "  -l <pct>    percentage of messages sent to logging socket (default: 10)\n"
+            "  -p <pct>    percentage of input frames toggling the presence of a contact,\n"
+            "              all contacts join first if > 0, requires -F (default: 0)\n"
+            "  -c <cols>   terminal columns (default: 120)\n"
+            "  -R <rows>   terminal rows (default: 40)\n"
+            "  -F          enable the framed mode of the GUI (see ENV_FRAMED) and\n"
+            "              send binary frames if it is offered\n"
+            "  -k <count>  restarts of the UI sockets after the load, measures the\n"
+            "              time until the GUI has reconnected (default: 0)\n"
+            "  -T <trace>  replay trace captured by the GUI instead of generated load\n"
+            "  -x <speed>  speed factor of replay, 0 = maximum (default: 1)\n"
+            "  -H          run GUI with headless render backend\n"
+            "  -L          measure lines/s of byte-wise and buffered reading of\n"
+            "              socket lines instead of running the GUI\n",
+            prog);
+}
+
+
+/**
+ * Parses the command line options of the benchmark.
+ * @param opt  Pointer to options structure
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return 0 on success, -1 on invalid options
+ */
+int
+parse_opts(BENCH_OPTS_T* opt, int argc, char** argv)
+{
+    int c;
+    memset(opt, 0, sizeof(*opt));
+    opt->gui      = "./dchat-gui";
+    opt->count    = 100000;
+    opt->min_size = 20;
+    opt->max_size = 200;
+    opt->nicks    = 50;
+    opt->zipf     = 1.0;
+    opt->log_pct  = 10;
+    opt->cols     = 120;
+    opt->rows     = 40;
+    opt->speed    = 1;
+
+    while ((c = getopt(argc, argv, "g:n:r:s:S:u:z:l:p:c:R:Fk:T:x:HL")) != -1)
+    {
+        switch (c)
+        {
+            case 'g':
+                opt->gui = optarg;
+                break;
+
+            case 'n':
+                opt->count = atol(optarg);
+                break;
+
+            case 'r':
+                opt->rate = atol(optarg);
+                break;
+
+            case 's':
+                opt->min_size = atoi(optarg);
+                break;
+
+            case 'S':
+                opt->max_size = atoi(optarg);
+                break;
+
+            case 'u':
+                opt->nicks = atoi(optarg);
+                break;
+
+            case 'z':
+                opt->zipf = atof(optarg);
+                break;
+
+            case 'l':
+                opt->log_pct = atoi(optarg);
+                break;
+
+            case 'p':
+                opt->pres_pct = atoi(optarg);
+                break;
+
+            case 'c':
+                opt->cols = atoi(optarg);
+                break;
+
+            case 'R':
+                opt->rows = atoi(optarg);
+                break;
+
+            case 'F':
+                opt->framed = 1;
+                break;
+
+            case 'k':
+                opt->restarts = atoi(optarg);
+                break;
+
+            case 'T':
+                opt->trace = optarg;
+                break;
+
+            case 'x':
+                opt->speed = atof(optarg);
+                break;
+
+            case 'H':
+                opt->headless = 1;
+                break;
+
+            case 'L':
+                opt->reader = 1;
+                break;
+
+            default:
+                return -1;
+        }
+    }
+
+    if (opt->count < 1 || opt->rate < 0 || opt->min_size < 1 ||
+        opt->max_size < opt->min_size || opt->max_size > BENCH_BATCH / 2 ||
+        opt->nicks < 1 || opt->zipf < 0 ||
+        opt->log_pct < 0 || opt->log_pct > 100 || opt->pres_pct < 0 ||
+        opt->pres_pct > 100 || (opt->pres_pct > 0 && !opt->framed) ||
+        opt->restarts < 0 || opt->speed < 0 || opt->cols < 20 ||
+        opt->rows < 10)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Returns the current time of the monotonic clock in microseconds.
+ * @return Microseconds since an unspecified starting point
+ */
+long long
+bench_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * Returns the next pseudo random number (xorshift64*).
+ * @param b Pointer to benchmark structure
+ * @return Pseudo random number
+ */
+uint64_t
+next_random(BENCH_T* b)
+{
+    b->rng ^= b->rng >> 12;
+    b->rng ^= b->rng << 25;
+    b->rng ^= b->rng >> 27;
+    return b->rng * 0x2545F4914F6CDD1DULL;
+}
+
+
+/**
+ * Creates a listening unix domain socket.
+ * @param path Local socket path to bind to
+ * @return File descriptor or -1 on error
+ */
+int
+unix_listen(char* path)
+{
+    int fd;
+    struct sockaddr_un unix_addr;
+    memset(&unix_addr, 0, sizeof(unix_addr));
+    unix_addr.sun_family = PF_LOCAL;
+    strncpy(unix_addr.sun_path, path, sizeof(unix_addr.sun_path) - 1);
+    unlink(path);
+
+    if ((fd = socket(PF_LOCAL, SOCK_STREAM, 0)) == -1)
+    {
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr*) &unix_addr, sizeof(unix_addr)) == -1 ||
+        listen(fd, 1) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/**
+ * Accepts a connection on a listening socket.
+ * @param srv     Listening socket
+ * @param timeout Time to wait for a connection in ms
+ * @return File descriptor or -1 on error or timeout
+ */
+int
+unix_accept(int srv, int timeout)
+{
+    struct pollfd pfd = { .fd = srv, .events = POLLIN };
+
+    if (poll(&pfd, 1, timeout) != 1)
+    {
+        return -1;
+    }
+
+    return accept(srv, NULL, NULL);
+}
+
+
+/**
+ * Writes a buffer completely to a blocking file descriptor.
+ * @param fd  File descriptor to write to
+ * @param buf Buffer to write
+ * @param len Length of buffer
+ * @return 0 on success, -1 on error
+ */
+int
+write_all(int fd, char* buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0)
+    {
+        if ((ret = write(fd, buf, len)) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        buf += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Initializes the benchmark.
+ * Creates a temporary directory containing the listening UI unix sockets.
+ * @param b Pointer to benchmark structure
+ * @return 0 on success, -1 otherwise
+ */
+int
+init_bench(BENCH_T* b)
+{
+    BENCH_OPTS_T opt = b->opt;
+    memset(b, 0, sizeof(*b));
+    b->opt = opt;
+    b->inp_srv = b->out_srv = b->log_srv = -1;
+    b->inp = b->out = b->log = b->pty = -1;
+    b->rng = 0x9E3779B97F4A7C15ULL;
+    strcpy(b->dir, "/tmp/dchat-bench.XXXXXX");
+
+    if (mkdtemp(b->dir) == NULL)
+    {
+        b->dir[0] = '\0';
+        return -1;
+    }
+
+    snprintf(b->inp_path, sizeof(b->inp_path), "%s/dinp.sock", b->dir);
+    snprintf(b->out_path, sizeof(b->out_path), "%s/dout.sock", b->dir);
+    snprintf(b->log_path, sizeof(b->log_path), "%s/dlog.sock", b->dir);
+    snprintf(b->stats_path, sizeof(b->stats_path), "%s/stats", b->dir);
+
+    if ((b->inp_srv = unix_listen(b->inp_path)) == -1 ||
+        (b->out_srv = unix_listen(b->out_path)) == -1 ||
+        (b->log_srv = unix_listen(b->log_path)) == -1)
+    {
+        return -1;
+    }
+
+    if ((b->reconnect = calloc(opt.restarts + 1, sizeof(long long))) == NULL)
+    {
+        return -1;
+    }
+
+    init_nicks(b);
+    return 0;
+}
+
+
+/**
+ * Frees all resources of the benchmark and removes its temporary directory.
+ * @param b Pointer to benchmark structure
+ */
+void
+free_bench(BENCH_T* b)
+{
+    int fds[] = { b->inp_srv, b->out_srv, b->log_srv, b->inp, b->out, b->log };
+
+    for (int i = 0; i < sizeof(fds)/sizeof(int); i++)
+    {
+        if (fds[i] != -1)
+        {
+            close(fds[i]);
+        }
+    }
+
+    if (b->dir[0] != '\0')
+    {
+        unlink(b->inp_path);
+        unlink(b->out_path);
+        unlink(b->log_path);
+        unlink(b->stats_path);
+        rmdir(b->dir);
+    }
+
+    if (b->nick_names != NULL)
+    {
+        for (int i = 0; i < b->opt.nicks; i++)
+        {
+            free(b->nick_names[i]);
+        }
+    }
+
+    free(b->nick_names);
+    free(b->nick_cdf);
+    free(b->present);
+    free(b->reconnect);
+}
+
+
+/**
+ * Initializes the nicknames of contacts and their distribution.
+ * Nickname k (starting with 1) is picked with a probability
+ * proportional to 1 / k^zipf.
+ * @param b Pointer to benchmark structure
+ */
+void
+init_nicks(BENCH_T* b)
+{
+    double sum = 0;
+    b->nick_names = malloc(b->opt.nicks * sizeof(char*));
+    b->nick_cdf   = malloc(b->opt.nicks * sizeof(double));
+    b->present    = calloc(b->opt.nicks, 1);
+
+    if (b->nick_names == NULL || b->nick_cdf == NULL || b->present == NULL)
+    {
+        exit(1);
+    }
+
+    for (int i = 0; i < b->opt.nicks; i++)
+    {
+        if ((b->nick_names[i] = malloc(24)) == NULL)
+        {
+            exit(1);
+        }
+
+        snprintf(b->nick_names[i], 24, "contact%d", i + 1);
+        sum += 1.0 / pow(i + 1, b->opt.zipf);
+        b->nick_cdf[i] = sum;
+    }
+
+    for (int i = 0; i < b->opt.nicks; i++)
+    {
+        b->nick_cdf[i] /= sum;
+    }
+}
+
+
+/**
+ * Formats a line of the input socket as text or binary frame.
+ * @param b        Pointer to benchmark structure
+ * @param buf      Buffer the line is written to
+ * @param type     Type of line: enum frametypes
+ * @param nickname Nickname of sender or contact
+ * @param body     Message text or onion ID
+ * @param len      Length of body
+ * @return Length of line
+ */
+int
+format_line(BENCH_T* b, char* buf, int type, char* nickname, char* body,
+            size_t len)
+{
+    FRAMEHDR_T hdr = { .len = len, .type = type, .nick_len = strlen(nickname) };
+    char* p = buf;
+
+    if (!b->framed)
+    {
+        // text: nickname;message
+        p += sprintf(p, "%s;", nickname);
+        memcpy(p, body, len);
+        p[len] = '\n';
+        return p + len + 1 - buf;
+    }
+
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, nickname, hdr.nick_len + 1);
+    p += hdr.nick_len + 1;
+    memcpy(p, body, len);
+    p[len] = '\0';
+    return p + len + 1 - buf;
+}
+
+
+/**
+ * Formats a line toggling the presence of a contact.
+ * @param b   Pointer to benchmark structure
+ * @param i   Index of contact
+ * @param buf Buffer the line is written to
+ * @return Length of line
+ */
+int
+presence_line(BENCH_T* b, int i, char* buf)
+{
+    char onion[17];
+
+    b->present[i] = !b->present[i];
+    b->sent_pres++;
+    // onion IDs have 16 characters
+    snprintf(onion, sizeof(onion), "%016llx",
+             (unsigned long long) i * 0x9e3779b97f4a7c15ULL);
+    return format_line(b, buf, b->present[i] ? FRAME_JOIN : FRAME_LEAVE,
+                       b->nick_names[i], onion, 16);
+}
+
+
+/**
+ * Picks a random nickname according to the nickname distribution.
+ * @param b Pointer to benchmark structure
+ * @return Nickname
+ */
+char*
+pick_nick(BENCH_T* b)
+{
+    double r = (next_random(b) >> 11) * (1.0 / 9007199254740992.0);
+    int lo = 0, hi = b->opt.nicks - 1, mid;
+
+    // binary search within cumulative distribution
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+
+        if (b->nick_cdf[mid] < r)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return b->nick_names[lo];
+}
+
+
+/**
+ * Runs the GUI within a pseudo terminal.
+ * The socket paths of the GUI are set to the ones of the benchmark.
+ * @param b Pointer to benchmark structure
+ * @return 0 on success, -1 otherwise
+ */
+int
+spawn_gui(BENCH_T* b)
+{
+    struct winsize ws = { .ws_row = b->opt.rows, .ws_col = b->opt.cols };
+    char* slave;
+    int fd;
+
+    if (b->opt.headless)
+    {
+        return spawn_headless(b);
+    }
+
+    if ((b->pty = posix_openpt(O_RDWR | O_NOCTTY)) == -1 ||
+        grantpt(b->pty) == -1 || unlockpt(b->pty) == -1 ||
+        (slave = ptsname(b->pty)) == NULL)
+    {
+        return -1;
+    }
+
+    if ((b->pid = fork()) == -1)
+    {
+        return -1;
+    }
+
+    if (b->pid == 0)
+    {
+        // child: make pseudo terminal the controlling terminal
+        setsid();
+
+        if ((fd = open(slave, O_RDWR)) == -1)
+        {
+            _exit(127);
+        }
+
+        ioctl(fd, TIOCSCTTY, 0);
+        ioctl(fd, TIOCSWINSZ, &ws);
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+        close(b->pty);
+        setenv("TERM", "xterm", 1);
+        setenv(ENV_INP_SOCK, b->inp_path, 1);
+        setenv(ENV_OUT_SOCK, b->out_path, 1);
+        setenv(ENV_LOG_SOCK, b->log_path, 1);
+        setenv(ENV_STATS, b->stats_path, 1);
+
+        if (b->opt.framed)
+        {
+            setenv(ENV_FRAMED, "1", 1);
+        }
+
+        execl(b->opt.gui, b->opt.gui, (char*) NULL);
+        _exit(127);
+    }
+
+    return 0;
+}
+
+
+/**
+ * Runs the GUI with the headless render backend.
+ * Keyboard hits are written to a pipe connected to standard input
+ * of the GUI, terminal output is discarded.
+ * @param b Pointer to benchmark structure
+ * @return 0 on success, -1 otherwise
+ */
+int
+spawn_headless(BENCH_T* b)
+{
+    char size[32];
+    int fds[2], fd;
+
+    if (pipe(fds) == -1)
+    {
+        return -1;
+    }
+
+    if ((b->pid = fork()) == -1)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (b->pid == 0)
+    {
+        if ((fd = open("/dev/null", O_RDWR)) == -1)
+        {
+            _exit(127);
+        }
+
+        dup2(fds[0], STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        close(fd);
+        snprintf(size, sizeof(size), "%dx%d", b->opt.cols, b->opt.rows);
+        setenv(ENV_HEADLESS, size, 1);
+        setenv(ENV_INP_SOCK, b->inp_path, 1);
+        setenv(ENV_OUT_SOCK, b->out_path, 1);
+        setenv(ENV_LOG_SOCK, b->log_path, 1);
+        setenv(ENV_STATS, b->stats_path, 1);
+
+        if (b->opt.framed)
+        {
+            setenv(ENV_FRAMED, "1", 1);
+        }
+
+        execl(b->opt.gui, b->opt.gui, (char*) NULL);
+        _exit(127);
+    }
+
+    close(fds[0]);
+    b->pty = fds[1];
+    return 0;
+}
+
+
+/**
+ * Thread function that discards the terminal output of the GUI.
+ * @param ptr Pointer to benchmark structure
+ * @return NULL
+ */
+void*
+th_drain_pty(void* ptr)
+{
+    BENCH_T* b = ptr;
+    char buf[BENCH_BATCH];
+
+    // returns on EIO after the GUI exited
+    while (read(b->pty, buf, sizeof(buf)) > 0 || errno == EINTR)
+    {
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Accepts the connections of the GUI to all UI unix sockets.
+ * @param b Pointer to benchmark structure
+ * @return 0 on success, -1 otherwise
+ */
+int
+accept_socks(BENCH_T* b)
+{
+    if ((b->inp = unix_accept(b->inp_srv, BENCH_TIMEOUT)) == -1 ||
+        (b->out = unix_accept(b->out_srv, BENCH_TIMEOUT)) == -1 ||
+        (b->log = unix_accept(b->log_srv, BENCH_TIMEOUT)) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Accepts the connections of the GUI and starts the session like a core.
+ * Answers the offer of the framed mode if framing is enabled and
+ * sends the nickname of the user.
+ * @param b Pointer to benchmark structure
+ * @return 0 on success, -1 otherwise
+ */
+int
+accept_gui(BENCH_T* b)
+{
+    char line[64];
+
+    if (accept_socks(b) == -1)
+    {
+        return -1;
+    }
+
+    // the GUI offers the framed mode right after connecting
+    if (b->opt.framed)
+    {
+        struct pollfd pfd = { .fd = b->inp, .events = POLLIN };
+
+        if (poll(&pfd, 1, BENCH_TIMEOUT) != 1 ||
+            read(b->inp, line, strlen(FRAME_HELLO)) != strlen(FRAME_HELLO) ||
+            memcmp(line, FRAME_HELLO, strlen(FRAME_HELLO)) != 0 ||
+            write_all(b->inp, FRAME_MAGIC, FRAME_MAGIC_LEN) == -1)
+        {
+            return -1;
+        }
+
+        b->framed = 1;
+    }
+
+    // first line defines the nickname of the user
+    return write_all(b->inp, line,
+                     format_line(b, line, FRAME_NICKNAME, BENCH_NICKNAME, "", 0));
+}
+
+
+/**
+ * Sends the configured load to the GUI.
+ * Messages are collected in batches of at most BENCH_BATCH bytes per
+ * socket. If a rate is configured, every message is written on its own
+ * and paced to match the rate.
+ * @param b Pointer to benchmark structure
+ * @return 0 on success, -1 on error
+ */
+int
+send_load(BENCH_T* b)
+{
+    static char inp_buf[BENCH_BATCH];
+    static char log_buf[BENCH_BATCH];
+    static char text[BENCH_BATCH / 2 + 32];
+    size_t inp_len = 0, log_len = 0;
+    long long start = bench_now_us(), due;
+    int max_line = b->opt.max_size + 64;
+    int size, log, n;
+    char* buf;
+    size_t* len;
+
+    // every contact joins before the load starts, presence is only
+    // signaled by frames
+    for (int i = 0; b->framed && b->opt.pres_pct > 0 && i < b->opt.nicks; i++)
+    {
+        inp_len += presence_line(b, i, inp_buf + inp_len);
+        b->sent_inp++;
+
+        if (inp_len + max_line >= BENCH_BATCH)
+        {
+            if (write_all(b->inp, inp_buf, inp_len) == -1)
+            {
+                return -1;
+            }
+
+            b->bytes += inp_len;
+            inp_len = 0;
+        }
+    }
+
+    for (long i = 0; i < b->opt.count; i++)
+    {
+        log  = (int) (next_random(b) % 100) < b->opt.log_pct;
+        buf  = log ? log_buf : inp_buf;
+        len  = log ? &log_len : &inp_len;
+        size = b->opt.min_size +
+               next_random(b) % (b->opt.max_size - b->opt.min_size + 1);
+
+        if (b->framed && !log && (int) (next_random(b) % 100) < b->opt.pres_pct)
+        {
+            *len += presence_line(b, next_random(b) % b->opt.nicks, buf + *len);
+        }
+        else
+        {
+            n = sprintf(text, "%ld ", i);
+
+            for (int j = 0; j < size; j++)
+            {
+                text[n++] = 'a' + next_random(b) % 26;
+            }
+
+            // logging socket always receives text lines
+            if (log)
+            {
+                memcpy(buf + *len, text, n);
+                buf[*len + n] = '\n';
+                *len += n + 1;
+            }
+            else
+            {
+                *len += format_line(b, buf + *len, FRAME_MESSAGE, pick_nick(b), text, n);
+            }
+        }
+
+        if (log)
+        {
+            b->sent_log++;
+        }
+        else
+        {
+            b->sent_inp++;
+        }
+
+        // collect messages unless they have to be paced
+        if (b->opt.rate == 0 && *len + max_line < BENCH_BATCH)
+        {
+            continue;
+        }
+
+        if (write_all(b->inp, inp_buf, inp_len) == -1 ||
+            write_all(b->log, log_buf, log_len) == -1)
+        {
+            return -1;
+        }
+
+        b->bytes += inp_len + log_len;
+        inp_len = log_len = 0;
+
+        if (b->opt.rate > 0)
+        {
+            due = start + (i + 1) * 1000000LL / b->opt.rate;
+
+            while (bench_now_us() < due)
+            {
+                usleep(100);
+            }
+        }
+    }
+
+    if (write_all(b->inp, inp_buf, inp_len) == -1 ||
+        write_all(b->log, log_buf, log_len) == -1)
+    {
+        return -1;
+    }
+
+    b->bytes += inp_len + log_len;
+    return 0;
+}
+
+
+/**
+ * Waits until the GUI has read all data from the UI unix sockets.
+ * @param b Pointer to benchmark structure
+ */
+void
+wait_consumed(BENCH_T* b)
+{
+    int inp_q, log_q;
+
+    do
+    {
+        usleep(1000);
+
+        if (ioctl(b->inp, SIOCOUTQ, &inp_q) == -1 ||
+            ioctl(b->log, SIOCOUTQ, &log_q) == -1)
+        {
+            return;
+        }
+    }
+    while (inp_q > 0 || log_q > 0);
+}
+
+
+/**
+ * Returns the CPU time consumed by a process.
+ * Unlike /proc/<pid>/stat, schedstat is not limited to the resolution
+ * of clock ticks, so that short frames are not missed.
+ * @param pid Process id
+ * @return CPU time in ns, -1 on error
+ */
+long long
+proc_cpu_ns(pid_t pid)
+{
+    char path[64];
+    long long ns;
+    FILE* f;
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", (int) pid);
+
+    if ((f = fopen(path, "r")) == NULL)
+    {
+        return -1;
+    }
+
+    if (fscanf(f, "%lld", &ns) != 1)
+    {
+        ns = -1;
+    }
+
+    fclose(f);
+    return ns;
+}
+
+
+/**
+ * Replays a trace captured by the GUI.
+ * The data of each record is written to the socket it has been received
+ * on, keeping the pace of the trace scaled by the speed factor. Data is
+ * written as captured, so the GUI reads it in chunks like in the
+ * captured session. Reconnections within the trace are replayed by
+ * closing the connections and accepting the new ones of the GUI.
+ * @param b Pointer to benchmark structure
+ * @return 0 on success, -1 on error
+ */
+int
+replay_trace(BENCH_T* b)
+{
+    char sig[TRACE_SIG_LEN];
+    TRACEREC_T rec;
+    char* buf = NULL;
+    size_t size = 0;
+    long long start = bench_now_us(), first = -1, due;
+    int ret = 0, fd;
+    FILE* f;
+
+    if ((f = fopen(b->opt.trace, "r")) == NULL)
+    {
+        return -1;
+    }
+
+    if (fread(sig, TRACE_SIG_LEN, 1, f) != 1 ||
+        memcmp(sig, TRACE_SIGNATURE, TRACE_SIG_LEN) != 0)
+    {
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // a truncated last record ends the replay
+    while (ret == 0 && fread(&rec, sizeof(rec), 1, f) == 1)
+    {
+        if (rec.len > size)
+        {
+            size = rec.len;
+
+            if ((buf = realloc(buf, size)) == NULL)
+            {
+                exit(1);
+            }
+        }
+
+        if (fread(buf, 1, rec.len, f) != rec.len)
+        {
+            break;
+        }
+
+        first = first == -1 ? rec.time : first;
+        b->trace_ns = rec.time - first;
+
+        if (b->opt.speed > 0 &&
+            (due = start + b->trace_ns / 1000 / b->opt.speed - bench_now_us()) > 0)
+        {
+            usleep(due);
+        }
+
+        if (rec.source == TRACE_CONNECT)
+        {
+            // GUI is connected when the replay starts. All data has been
+            // read before the connection ended, so it is consumed first.
+            if (b->replayed > 0)
+            {
+                wait_consumed(b);
+                close(b->inp);
+                close(b->out);
+                close(b->log);
+                b->inp = b->out = b->log = -1;
+                ret = accept_socks(b);
+            }
+        }
+        else
+        {
+            fd  = rec.source == TRACE_LOG ? b->log : b->inp;
+            ret = write_all(fd, buf, rec.len);
+            b->bytes += rec.len;
+        }
+
+        b->replayed++;
+    }
+
+    free(buf);
+    fclose(f);
+    return ret;
+}
+
+
+/**
+ * Waits until the GUI has processed all received messages.
+ * The GUI is considered idle if it did not consume CPU time for
+ * BENCH_IDLE milliseconds.
+ * @param b Pointer to benchmark structure
+ */
+void
+wait_idle(BENCH_T* b)
+{
+    long long last = proc_cpu_ns(b->pid), cur;
+
+    while (1)
+    {
+        usleep(BENCH_IDLE * 1000);
+
+        if ((cur = proc_cpu_ns(b->pid)) == last || cur == -1)
+        {
+            return;
+        }
+
+        last = cur;
+    }
+}
+
+
+/**
+ * Prints the latency statistics written by the GUI on exit.
+ * @param b Pointer to benchmark structure
+ */
+void
+print_stats(BENCH_T* b)
+{
+    char line[256];
+    FILE* f;
+
+    if ((f = fopen(b->stats_path, "r")) == NULL)
+    {
+        return;
+    }
+
+    printf("\n");
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        fputs(line, stdout);
+    }
+
+    fclose(f);
+}
+
+
+/**
+ * Restarts the UI unix sockets like a restarting core.
+ * All connections and listening sockets are closed and the socket files
+ * are removed. After BENCH_DOWNTIME ms the sockets are created again and
+ * the GUI has to reconnect.
+ * @param b Pointer to benchmark structure
+ * @return Time from creating the sockets until the GUI has connected to
+ *         all of them in us, -1 on error
+ */
+long long
+restart_core(BENCH_T* b)
+{
+    int* fds[] = { &b->inp, &b->out, &b->log, &b->inp_srv, &b->out_srv, &b->log_srv };
+    long long start;
+
+    for (int i = 0; i < sizeof(fds)/sizeof(int*); i++)
+    {
+        if (*fds[i] != -1)
+        {
+            close(*fds[i]);
+            *fds[i] = -1;
+        }
+    }
+
+    unlink(b->inp_path);
+    unlink(b->out_path);
+    unlink(b->log_path);
+    usleep(BENCH_DOWNTIME * 1000);
+    start = bench_now_us();
+
+    if ((b->inp_srv = unix_listen(b->inp_path)) == -1 ||
+        (b->out_srv = unix_listen(b->out_path)) == -1 ||
+        (b->log_srv = unix_listen(b->log_path)) == -1 ||
+        accept_gui(b) == -1)
+    {
+        return -1;
+    }
+
+    return bench_now_us() - start;
+}
+
+
+/**
+ * Compares two latencies (qsort() callback).
+ * @param a Pointer to first latency
+ * @param b Pointer to second latency
+ * @return <0, 0 or >0 if the first latency is lower, equal or higher
+ */
+int
+cmp_latency(const void* a, const void* b)
+{
+    long long x = *(const long long*) a, y = *(const long long*) b;
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * Prints the reconnect latencies measured by restart_core().
+ * @param b Pointer to benchmark structure
+ */
+void
+print_reconnects(BENCH_T* b)
+{
+    int n = b->opt.restarts;
+
+    if (n == 0)
+    {
+        return;
+    }
+
+    qsort(b->reconnect, n, sizeof(long long), cmp_latency);
+    printf("reconnect:       %d restarts, p50 %.1f ms, max %.1f ms\n", n,
+           b->reconnect[n / 2] / 1e3, b->reconnect[n - 1] / 1e3);
+}
+
+
+/**
+ * Stops the GUI by typing F1 and waits for it to exit.
+ * @param b  Pointer to benchmark structure
+ * @param ru Will contain the resource usage of the GUI
+ * @return 0 on success, -1 otherwise
+ */
+int
+quit_gui(BENCH_T* b, struct rusage* ru)
+{
+    int status;
+    memset(ru, 0, sizeof(*ru));
+    write_all(b->pty, BENCH_KEY_F1, strlen(BENCH_KEY_F1));
+
+    if (wait4(b->pid, &status, 0, ru) == -1)
+    {
+        return -1;
+    }
+
+    close(b->pty);
+    return 0;
+}
+
+
+/**
+ * Reads a line byte by byte, as the GUI did before its buffered line
+ * reader. Serves as reference of the line reader benchmark.
+ * @param fd   File descriptor to read from
+ * @param line Will point to the allocated line, freed by the caller
+ * @return Length of line excluding \\0, 0 on EOF, -1 on error
+ */
+int
+read_line_bytewise(int fd, char** line)
+{
+    char* ptr;
+    char* alc_ptr;
+    int len = 1;
+    int ret;
+    *line = NULL;
+
+    do
+    {
+        if ((alc_ptr = realloc(*line, len + 1)) == NULL)
+        {
+            free(*line);
+            exit(1);
+        }
+
+        *line = alc_ptr;
+        ptr = *line + len - 1;
+        len++;
+    }
+    while ((ret = read(fd, ptr, 1)) > 0 && *ptr != '\n');
+
+    if (ret <= 0)
+    {
+        free(*line);
+        *line = NULL;
+        return ret;
+    }
+
+    *ptr = '\0';
+    return len - 1;
+}
+
+
+/**
+ * Measures the rate a line reader reads lines from a unix socket.
+ * A child process writes the lines to one end of a socket pair, the
+ * lines are read from the other end.
+ * @param b        Pointer to benchmark structure
+ * @param lines    Lines to write
+ * @param len      Length of lines
+ * @param buffered 1 to read with read_line() of the GUI, 0 byte by byte
+ * @return Lines per second, -1 on error
+ */
+double
+measure_reader(BENCH_T* b, char* lines, size_t len, int buffered)
+{
+    LINEBUF_T lb;
+    char* line;
+    long long start;
+    long n = 0;
+    int sv[2];
+    pid_t pid;
+    int ret;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+    {
+        return -1;
+    }
+
+    if ((pid = fork()) == -1)
+    {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        close(sv[0]);
+        _exit(write_all(sv[1], lines, len) == -1);
+    }
+
+    close(sv[1]);
+    init_linebuf(&lb, NULL);
+    start = bench_now_us();
+
+    while ((ret = buffered ? read_line(&lb, sv[0], &line) :
+                             read_line_bytewise(sv[0], &line)) > 0)
+    {
+        if (!buffered)
+        {
+            free(line);
+        }
+
+        n++;
+    }
+
+    start = bench_now_us() - start;
+    free_linebuf(&lb);
+    close(sv[0]);
+    waitpid(pid, NULL, 0);
+    return ret == -1 || n != b->opt.count ? -1 : n / (start / 1e6);
+}
+
+
+/**
+ * Runs the line reader benchmark.
+ * The options -n, -s and -S define the number and lengths of the lines.
+ * @param b Pointer to benchmark structure
+ * @return 0 on success, -1 on error
+ */
+int
+bench_reader(BENCH_T* b)
+{
+    size_t len = 0, size = (size_t) b->opt.count * (b->opt.max_size + 8);
+    double bytewise, buffered;
+    char* lines;
+    int n;
+
+    if ((lines = malloc(size)) == NULL)
+    {
+        exit(1);
+    }
+
+    for (long i = 0; i < b->opt.count; i++)
+    {
+        n = b->opt.min_size + i % (b->opt.max_size - b->opt.min_size + 1);
+        len += sprintf(lines + len, "%s;", BENCH_NICKNAME);
+        memset(lines + len, 'a' + i % 26, n);
+        len += n;
+        lines[len++] = '\n';
+    }
+
+    if ((bytewise = measure_reader(b, lines, len, 0)) == -1 ||
+        (buffered = measure_reader(b, lines, len, 1)) == -1)
+    {
+        perror("dchat-bench");
+        free(lines);
+        return -1;
+    }
+
+    printf("lines:           %ld (%zu bytes)\n", b->opt.count, len);
+    printf("byte-wise:       %.0f lines/s\n", bytewise);
+    printf("buffered:        %.0f lines/s\n", buffered);
+    free(lines);
+    return 0;
+}
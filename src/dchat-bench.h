@@ -0,0 +1,139 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DCHAT_BENCH_H
+#define DCHAT_BENCH_H
+
+
+//*********************************
+//        BENCH SETTINGS
+//*********************************
+#define BENCH_NICKNAME  "BENCH"  // nickname announced to the GUI
+#define BENCH_BATCH     65536    // maximum bytes written at once
+#define BENCH_TIMEOUT   10000    // ms to wait for the GUI to connect
+#define BENCH_IDLE      100      // ms without CPU usage until GUI is idle
+#define BENCH_KEY_F1    "\033OP" // key sequence of F1 (xterm)
+#define BENCH_DOWNTIME  200      // ms the UI sockets are gone on a restart
+
+
+//*********************************
+//         STRUCTURES
+//*********************************
+
+/*!
+ * Options of the benchmark.
+ */
+typedef struct BENCH_OPTS
+{
+    char*  gui;      //!< Path to the GUI executable
+    long   count;    //!< Number of messages to send
+    long   rate;     //!< Messages per second, 0 for maximum rate
+    int    min_size; //!< Minimum length of message text
+    int    max_size; //!< Maximum length of message text
+    int    nicks;    //!< Number of distinct nicknames
+    double zipf;     //!< Zipf exponent of nickname distribution, 0 = uniform
+    int    log_pct;  //!< Percentage of messages sent to the logging socket
+    int    pres_pct; //!< Percentage of input lines toggling presence of a contact
+    int    cols;     //!< Columns of the terminal of the GUI
+    int    rows;     //!< Rows of the terminal of the GUI
+    int    headless; //!< 1 to run the GUI with the headless render backend
+    int    framed;   //!< 1 to send binary frames if the GUI offers them
+    int    restarts; //!< Number of restarts of the UI sockets after the load
+    char*  trace;    //!< Trace replayed instead of generated load, NULL for none
+    double speed;    //!< Speed factor of replay, 0 for maximum speed
+    int    reader;   //!< 1 to measure the line reader instead of the GUI
+} BENCH_OPTS_T;
+
+
+/*!
+ * State of the benchmark.
+ * The benchmark serves the UI unix sockets in a temporary directory and
+ * runs the GUI within a pseudo terminal.
+ */
+typedef struct BENCH
+{
+    BENCH_OPTS_T opt;        //!< Options of the benchmark
+    char   dir[64];          //!< Temporary directory of the unix sockets
+    char   inp_path[128];    //!< Path of input unix socket
+    char   out_path[128];    //!< Path of output unix socket
+    char   log_path[128];    //!< Path of logging unix socket
+    char   stats_path[128];  //!< Path of latency statistics of the GUI
+    int    inp_srv;          //!< Listening input unix socket
+    int    out_srv;          //!< Listening output unix socket
+    int    log_srv;          //!< Listening logging unix socket
+    int    inp;              //!< Connected input unix socket
+    int    out;              //!< Connected output unix socket
+    int    log;              //!< Connected logging unix socket
+    int    pty;              //!< Master side of the pseudo terminal or
+                             //!< keyboard pipe of the headless GUI
+    pid_t  pid;              //!< Process id of the GUI
+    char** nick_names;       //!< Nicknames of contacts
+    double* nick_cdf;        //!< Cumulative distribution of nicknames
+    char*  present;          //!< 1 for each contact that has joined
+    uint64_t rng;            //!< State of random number generator
+    int    framed;           //!< 1 if binary frames are sent to input socket
+    long   sent_inp;         //!< Messages sent to input socket
+    long   sent_log;         //!< Messages sent to logging socket
+    long   sent_pres;        //!< Presence lines within messages sent to input socket
+    long long bytes;         //!< Bytes sent
+    long   replayed;         //!< Records of trace replayed
+    long long trace_ns;      //!< Duration of replayed part of trace in ns
+    long long* reconnect;    //!< Reconnect latency of each restart in us
+} BENCH_T;
+
+
+//*********************************
+//          FUNCTIONS
+//*********************************
+void usage(char* prog);
+int parse_opts(BENCH_OPTS_T* opt, int argc, char** argv);
+long long bench_now_us();
+uint64_t next_random(BENCH_T* b);
+int unix_listen(char* path);
+int unix_accept(int srv, int timeout);
+int write_all(int fd, char* buf, size_t len);
+int init_bench(BENCH_T* b);
+void free_bench(BENCH_T* b);
+void init_nicks(BENCH_T* b);
+char* pick_nick(BENCH_T* b);
+int format_line(BENCH_T* b, char* buf, int type, char* nickname, char* body,
+                size_t len);
+int presence_line(BENCH_T* b, int i, char* buf);
+int spawn_gui(BENCH_T* b);
+int spawn_headless(BENCH_T* b);
+void* th_drain_pty(void* ptr);
+int accept_socks(BENCH_T* b);
+int accept_gui(BENCH_T* b);
+int send_load(BENCH_T* b);
+int replay_trace(BENCH_T* b);
+void wait_consumed(BENCH_T* b);
+long long proc_cpu_ns(pid_t pid);
+void wait_idle(BENCH_T* b);
+void print_stats(BENCH_T* b);
+long long restart_core(BENCH_T* b);
+int cmp_latency(const void* a, const void* b);
+void print_reconnects(BENCH_T* b);
+int quit_gui(BENCH_T* b, struct rusage* ru);
+int read_line_bytewise(int fd, char** line);
+double measure_reader(BENCH_T* b, char* lines, size_t len, int buffered);
+int bench_reader(BENCH_T* b);
+
+
+#endif
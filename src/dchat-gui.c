@@ -21,7 +21,15 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#define _GNU_SOURCE
+#define NCURSES_WIDECHAR 1
+#if defined HAVE_NCURSESW_CURSES_H
+#include <ncursesw/curses.h>
+#elif defined HAVE_NCURSESW_H
+#include <ncursesw.h>
+#else
 #include <ncurses.h>
+#endif
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
@@ -31,8 +39,24 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <strings.h>
+#include <locale.h>
+#include <wchar.h>
+#include <limits.h>
 
 #include "dchat-gui.h"
 
@@ -40,36 +64,140 @@
 //*********************************
 //        GLOBAL VARIABLES
 //*********************************
-static pthread_mutex_t _win_lock; //!< mutex for signaling a window lock
 static DWINDOW_T* _win_msg;       //!< main chat window containing messages
 static DWINDOW_T* _win_usr;       //!< window containing active contacts
 static DWINDOW_T* _win_inp;       //!< window containing current user input
+static WINDOW*    _win_sts;       //!< status line above the chat windows
+static WINDOW*    _win_stats;     //!< overlay showing latency statistics
 static DWINDOW_T*
 _win_cur;       //!< pointer that holds the current selected window
 static ipc
 _ipc;           //!< holds file descriptor information to communicate with another process via ipc
-static char* _nickname = SELF; // !< default nickname
+static char _self[] = SELF;     // !< default nickname
+static char* _nickname = _self; // !< nickname of the user, default or allocated
+static render
+_render;        //!< holds dirty windows and frame timing of the render scheduler
+static MSGSTORE_T
+_store;         //!< holds the message history shown in the message window
+static MSGVIEW_T
+_view = { .follow = 1 }; //!< position of message window within message history
+static MSGQUEUE_T
+_queue;         //!< lock-free queue of messages not yet moved into the store
+static BACKEND_T _backend_term =
+{
+    "terminal", term_start, term_stop, term_present
+};              //!< renders to the terminal of the process
+static BACKEND_T _backend_headless =
+{
+    "headless", headless_start, headless_stop, headless_present
+};              //!< renders into an in-memory screen grid
+static BACKEND_T*
+_backend = &_backend_term; //!< render backend in use
+static HEADLESS_T
+_headless;      //!< screen grid of the headless render backend
+static STATS_T
+_stats;         //!< latency statistics of messages
+static HISTLOG_T
+_hist = { .fd = -1 }; //!< persistent message history
+static MSGINDEX_T
+_index;         //!< search index of the message store
+static SEARCH_T
+_search;        //!< state of the incremental search
+static ROSTER_T
+_roster;        //!< active contacts shown in the contact window
+static EDITOR_T
+_editor;        //!< line editor of the input window
+static signed char
+_widths[WIDTH_CACHE]; //!< display widths of the first code points
+static TRACE_T
+_trace;         //!< capture of data received on the UI unix sockets
 
 
 int
 main()
 {
-    pthread_t th_ipc;
+    sigset_t sigmask;
+    FILE* stats;
+    char* path;
+
+    // chat is UTF-8 encoded, the terminal shows it if its locale does
+    setlocale(LC_ALL, "");
+    init_widths();
+
+    if (init_backend() == -1)
+    {
+        fprintf(stderr, "Invalid value of %s, expected COLSxROWS\n",
+                ENV_HEADLESS);
+        exit(1);
+    }
 
-    if (pthread_mutex_init(&_win_lock, NULL) != 0)
+    set_frame_rate(RENDER_FPS);
+    init_store(&_store, STORE_MAX_MSGS, STORE_MAX_BYTES);
+    _store.index = &_index;
+
+    if (init_queue(&_queue, QUEUE_DRAIN) == -1)
+    {
+        exit(1);
+    }
+
+    // resize events are read from a signalfd by the event loop, so the
+    // signal is blocked before any other thread is started
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGWINCH);
+    pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+
+    if ((_render.sigfd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
     {
         exit(1);
     }
 
-    signal(SIGWINCH, resize_win); // check for resize events
     signal(SIGPIPE,
            SIG_IGN);     // prevent sigpipes if write() on broken pipes is used
     // start graphical user interface and wait for input
     start_gui();
-    pthread_create(&th_ipc, NULL, (void*) th_ipc_connector, NULL);
-    read_input();
+
+    // replay history, so that the last screens are shown immediately
+    if ((path = history_path()) != NULL)
+    {
+        if (open_history(&_hist, path) == 0)
+        {
+            load_history(&_hist, &_store, _win_msg->w, _win_msg->h * HIST_SCREENS);
+        }
+        else
+        {
+            append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                                "History '%s' not available: '%s'", path, strerror(errno));
+        }
+
+        free(path);
+    }
+
+    // capture data received from the core for replays
+    if ((path = getenv(ENV_CAPTURE)) != NULL && open_trace(&_trace, path) == -1)
+    {
+        append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                            "Capture to '%s' failed: '%s'", path, strerror(errno));
+    }
+
+    run_event_loop();
     stop_gui();
-    pthread_mutex_destroy(&_win_lock);
+    close_history(&_hist);
+    close_trace(&_trace);
+    // dump latency statistics
+    if (getenv(ENV_STATS) != NULL && (stats = fopen(getenv(ENV_STATS), "w")) != NULL)
+    {
+        write_stats(&_stats, stats);
+        fprintf(stats, "history dropped: %lu records\n", _hist.dropped);
+        fclose(stats);
+    }
+
+    free_queue(&_queue);
+    free_store(&_store);
+    free_index(&_index);
+    free(_search.cands);
+    free_roster(&_roster);
+    free_editor(&_editor);
+    close(_render.sigfd);
     return 0;
 }
 
@@ -123,14 +251,14 @@ init_wins()
 
 
 /**
- * Initialize graphical user interface.
- * This function initializes the chat GUI and renders
- * it on the screen.
+ * Calculates size and position of all chat windows.
+ * The windows are not changed, only their chat window structures.
+ * Every window keeps at least one row and column on small screens.
  * @param ratio_height relative height of message window to available rows
  * @param ratio_width  relative width of message window to available columns
  */
 void
-init_gui(float ratio_height, float ratio_width)
+layout_gui(float ratio_height, float ratio_width)
 {
     // dimension of virtual base window including padding
     int o_base    = 2;          // base offset
@@ -139,13 +267,16 @@ init_gui(float ratio_height, float ratio_width)
     int p_base    = 2;          // col/row padding
     // dimension of message field within virtual base window
     _win_msg->h       = h_base * ratio_height - p_base;
-    _win_msg->h_total = _win_msg->h * 16; // make virtual window 16 times the size
+    _win_msg->h       = _win_msg->h > 0 ? _win_msg->h : 1;
+    _win_msg->h_total = _win_msg->h; // view of message store
     _win_msg->w       = w_base * ratio_width - p_base;
+    _win_msg->w       = _win_msg->w > 0 ? _win_msg->w : 1;
     _win_msg->w_total = _win_msg->w;
     // dimension of user field within virtual base window
     _win_usr->h       = _win_msg->h;
-    _win_usr->h_total = _win_usr->h * 16; // make virtual window 16 times the size
+    _win_usr->h_total = _win_usr->h; // view of roster
     _win_usr->w       = w_base - _win_msg->w - p_base;
+    _win_usr->w       = _win_usr->w > 0 ? _win_usr->w : 1;
     _win_usr->w_total = _win_usr->w;
     // dimension of input field within virtual base window
     _win_inp->h       = 1;
@@ -164,20 +295,128 @@ init_gui(float ratio_height, float ratio_width)
     // position input field
     _win_inp->x = x_base;
     _win_inp->y = _win_msg->y + _win_msg->h + p_base;
+}
+
+
+/**
+ * Initialize graphical user interface.
+ * This function initializes the chat GUI and renders
+ * it on the screen.
+ * @param ratio_height relative height of message window to available rows
+ * @param ratio_width  relative width of message window to available columns
+ */
+void
+init_gui(float ratio_height, float ratio_width)
+{
+    layout_gui(ratio_height, ratio_width);
     // set standard background
     bkgd(COLOR_PAIR(COLOR_STDSCR));
     refresh();
     // draw windows
-    _win_msg->win = create_padwin(_win_msg->h_total, _win_msg->w_total, _win_msg->h,
-                                  _win_msg->w, _win_msg->y, _win_msg->x, COLOR_WINDOW_MESSAGE);
-    _win_usr->win = create_padwin(_win_usr->h_total, _win_usr->w_total, _win_usr->h,
-                                  _win_usr->w, _win_usr->y, _win_usr->x, COLOR_WINDOW_USER);
+    _win_sts      = create_win(1, COLS - _win_msg->x, 0, _win_msg->x, COLOR_STDSCR);
+    _win_msg->win = create_win(_win_msg->h, _win_msg->w, _win_msg->y, _win_msg->x,
+                               COLOR_WINDOW_MESSAGE);
+    _win_usr->win = create_win(_win_usr->h, _win_usr->w, _win_usr->y, _win_usr->x,
+                               COLOR_WINDOW_USER);
+    touch_roster(&_roster); // new window shows no contacts yet
     _win_inp->win = create_win(_win_inp->h, _win_inp->w, _win_inp->y, _win_inp->x,
                                COLOR_WINDOW_INPUT);
+    // statistics overlay is not shown until it is enabled
+    _win_stats = NULL;
+    place_stats();
     _win_cur = _win_inp; // focused window
 }
 
 
+/**
+ * Places the statistics overlay in the upper right corner of the
+ * message window.
+ * The overlay is created if the message window is large enough to hold
+ * it and removed if not.
+ */
+void
+place_stats()
+{
+    int y = _win_msg->y;
+    int x = _win_msg->x + _win_msg->w - STATS_WIDTH;
+
+    if (_win_msg->h < STATS_HEIGHT || _win_msg->w < STATS_WIDTH)
+    {
+        if (_win_stats != NULL)
+        {
+            delwin(_win_stats);
+            _win_stats    = NULL;
+            _stats.visible = 0;
+        }
+    }
+    else if (_win_stats != NULL)
+    {
+        mvwin(_win_stats, y, x);
+    }
+    else
+    {
+        _win_stats = newwin(STATS_HEIGHT, STATS_WIDTH, y, x);
+        wbkgd(_win_stats, COLOR_PAIR(COLOR_STDSCR));
+        leaveok(_win_stats, TRUE); // keep cursor within current window
+    }
+}
+
+
+/**
+ * Resizes and moves a window to the size and position of its chat
+ * window structure.
+ * @param win Pointer to chat window structure
+ */
+void
+place_win(DWINDOW_T* win)
+{
+    // resized first, so that the window fits the screen at its position
+    wresize(win->win, win->h, win->w);
+    mvwin(win->win, win->y, win->x);
+}
+
+
+/**
+ * Adapts the GUI to a new size of the screen.
+ * The windows are resized in place, so that their contents and the
+ * position within the message history are kept. Only the rows of the
+ * message history shown after the resize are laid out again.
+ */
+void
+resize_gui()
+{
+    size_t i = view_index(&_view, &_store);
+    int rows = 0;
+
+    if (i < _store.count)
+    {
+        rows = message_rows(&_store, get_message(&_store, i), _win_msg->w);
+    }
+
+    layout_gui(RATIO_HEIGHT, RATIO_WIDTH);
+    wresize(_win_sts, 1, COLS - _win_msg->x);
+    place_win(_win_msg);
+    place_win(_win_usr);
+    place_win(_win_inp);
+    place_stats();
+
+    // row shown in the top row keeps its relative position within the
+    // reflowed message
+    if (rows > 0 && !_view.follow)
+    {
+        _view.row = (long long) _view.row *
+                    message_rows(&_store, get_message(&_store, i), _win_msg->w) / rows;
+        scroll_view(&_view, &_store, _win_msg, 0);
+    }
+
+    touch_roster(&_roster);
+    // uncovered parts of the screen show the standard background
+    touchwin(stdscr);
+    wnoutrefresh(stdscr);
+    refresh_screen();
+}
+
+
 /**
  * Initializes ncurses and starts the GUI.
  * This functions initializes ncurses with the required
@@ -186,13 +425,22 @@ init_gui(float ratio_height, float ratio_width)
 void
 start_gui()
 {
-    initscr();            // initialize ncurses
+    // initialize ncurses
+    if (_backend->start() == -1)
+    {
+        fprintf(stderr, "Failed to start %s backend\n", _backend->name);
+        exit(1);
+    }
+
     cbreak();             // interprete control characters (CTRL-C, ...)
     noecho();             // dont print escape codes
     keypad(stdscr, TRUE); // make use of special key (arrow, ...)
+    nodelay(stdscr, TRUE); // keyboard hits are awaited by the event loop
     init_colors();        // initialize available colors
     init_wins();          // initialize all available windows
-    init_gui(0.95, 0.75); // calculate size / position and render gui
+    init_gui(RATIO_HEIGHT, RATIO_WIDTH); // calculate size / position and render gui
+    define_key(PASTE_BEGIN, KEY_PASTE); // pasted text is read at once
+    refresh_screen();     // draw all windows with the next frame
 }
 
 
@@ -205,6 +453,12 @@ free_wins()
     delwin(_win_msg->win);
     delwin(_win_usr->win);
     delwin(_win_inp->win);
+    delwin(_win_sts);
+
+    if (_win_stats != NULL)
+    {
+        delwin(_win_stats);
+    }
     free(_win_msg);
     free(_win_usr);
     free(_win_inp);
@@ -221,358 +475,633 @@ stop_gui()
 {
     // release resources and refresh screen
     free_wins();
-    endwin();
-    refresh();
-    erase();
+    _backend->stop();
 }
 
 
 /**
- * Creates a ncurses pad window.
- * This function creates a pad window and renders it on the screen.
- * @see newpad() of ncurses.h
- * @param max_height maximum height of pad window
- * @param max_width  maximum width of pad window
- * @param height     height of pad window shown on the screen
- * @param width      width of pad window shown on the screen
- * @param starty     y position of pad window shown on the screen
- * @param startx     x position of pad window shown on the screen
- * @param col_bkgd   background color of pad window shown on the screen
- * @return Pointer to ncurses window structure
+ * Selects the render backend.
+ * The headless backend is used if the environment variable
+ * ENV_HEADLESS specifies the size of its screen.
+ * @return 0 on success, -1 if the screen size is invalid
  */
-WINDOW*
-create_padwin(int max_height, int max_width, int height, int width, int starty,
-              int startx, const int col_bkgd)
+int
+init_backend()
 {
-    WINDOW* local_pad;
-    local_pad = newpad(max_height, max_width);
+    char* size = getenv(ENV_HEADLESS);
+    char c;
 
-    // check if terminal support colors
-    if (has_colors())
+    if (size == NULL)
     {
-        wbkgd(local_pad, COLOR_PAIR(col_bkgd));
+        _backend = &_backend_term;
+        return 0;
     }
 
-    // render pad win
-    prefresh(local_pad, 0, 0, starty, startx, starty + height - 1,
-             startx + width - 1);
-    return local_pad;
-}
-
-
-/**
- * Creates a ncurses window.
- * This function creates a window and renders it on the screen.
- * @see newwin() of ncurses.h
- * @param height     height of window shown on the screen
- * @param width      width of window shown on the screen
- * @param starty     y position of window shown on the screen
- * @param startx     x position of window shown on the screen
- * @param col_bkgd   background color of window shown on the screen
- * @return Pointer to ncurses window structure
- */
-WINDOW*
-create_win(int height, int width, int starty, int startx, const int col_bkgd)
-{
-    WINDOW* local_win;
-    int attr = 0;
-    local_win = newwin(height, width, starty, startx);
-
-    // check if terminal support colors
-    if (has_colors())
+    if (sscanf(size, "%dx%d%c", &_headless.cols, &_headless.rows, &c) != 2 ||
+        _headless.cols < 1 || _headless.rows < 1)
     {
-        wbkgd(local_win, COLOR_PAIR(col_bkgd));
+        return -1;
     }
 
-    // render win
-    wrefresh(local_win);
-    return local_win;
+    _backend = &_backend_headless;
+    return 0;
 }
 
 
 /**
- * Refreshes the contents of the given chat window.
- * @param win pointer to a chat window structure containing the actual window.
- * @see DWINDOW_T in dchat-gui.h
+ * Starts ncurses on the terminal of the process.
+ * @return 0 on success, -1 otherwise
  */
-void
-refresh_padwin(DWINDOW_T* win)
+int
+term_start(void)
 {
-    // autoscroll pad win if cursor is increased
-    if (win->y_count >= win->h)
-    {
-        prefresh(win->win, win->y_cursor, 0, win->y, win->x,
-                 win->y + win->h - 1, win->x + win->w - 1);
-    }
-    else
+    if (initscr() == NULL)
     {
-        prefresh(win->win, 0, 0, win->y, win->x, win->y + win->h - 1,
-                 win->x + win->w - 1);
+        return -1;
     }
+
+    // terminals not supporting bracketed paste ignore the sequence
+    putp(PASTE_ON);
+    return 0;
 }
 
 
 /**
- * Refreshes the contents of the current chat window.
+ * Stops ncurses on the terminal of the process.
  */
 void
-refresh_current()
+term_stop(void)
 {
-    int cur_win = current_winnr();
-
-    if (cur_win == WINDOW_MSG || cur_win == WINDOW_USR)
-    {
-        refresh_padwin(_win_cur);
-    }
-    else
-    {
-        wrefresh(_win_cur->win);
-    }
+    putp(PASTE_OFF);
+    endwin();
+    refresh();
+    erase();
 }
 
 
 /**
- * Refreshes the contents of all available chat windows.
+ * Flushes all staged windows to the terminal.
  */
 void
-refresh_screen()
+term_present(void)
 {
-    refresh_padwin(_win_msg);
-    refresh_padwin(_win_usr);
-    wrefresh(_win_inp->win);
-    move_win(_win_cur, _win_cur->y_cursor, _win_cur->x_cursor);
-    refresh_current();
+    doupdate();
 }
 
 
 /**
- * Returns the number of the current active chat window.
- * @return value of enum colors
- * @see enum colors in dchat-gui.h
+ * Starts ncurses on a screen that is not shown on any terminal.
+ * Ncurses writes its terminal output to /dev/null and reads keyboard hits
+ * from standard input.
+ * @return 0 on success, -1 otherwise
  */
 int
-current_winnr()
+headless_start(void)
 {
-    if (_win_cur == _win_msg)
+    size_t cells = (size_t) _headless.rows * _headless.cols;
+
+    if ((_headless.out = fopen("/dev/null", "w")) == NULL)
     {
-        return WINDOW_MSG;
+        return -1;
     }
 
-    if (_win_cur == _win_usr)
+    if ((_headless.scr = newterm(HEADLESS_TERM, _headless.out, stdin)) == NULL)
     {
-        return WINDOW_USR;
+        fclose(_headless.out);
+        return -1;
     }
 
-    if (_win_cur == _win_inp)
+    // +1: mvwin_wchnstr() terminates the last row
+    if ((_headless.cells = calloc(cells + 1, sizeof(cchar_t))) == NULL)
     {
-        return WINDOW_INP;
+        exit(1);
     }
 
-    return -1;
+    resizeterm(_headless.rows, _headless.cols);
+    return 0;
 }
 
 
 /**
- * Returns the currently active chat window.
- * @return Pointer to the currently active chat window.
- * @see enum windows in dchat-gui.h
+ * Stops ncurses on the headless screen.
+ * The screen is written to the file named by ENV_SNAPSHOT, if set.
  */
-DWINDOW_T*
-get_win(int winnr)
+void
+headless_stop(void)
 {
-    if (winnr == WINDOW_MSG)
-    {
-        return _win_msg;
-    }
-
-    if (winnr == WINDOW_USR)
-    {
-        return _win_usr;
-    }
+    char* path = getenv(ENV_SNAPSHOT);
+    FILE* f;
 
-    if (winnr == WINDOW_INP)
+    if (path != NULL && (f = fopen(path, "w")) != NULL)
     {
-        return _win_inp;
+        snapshot_screen(f);
+        fclose(f);
     }
 
-    return NULL;
+    endwin();
+    delscreen(_headless.scr);
+    fclose(_headless.out);
+    free(_headless.cells);
+    _headless.cells = NULL;
 }
 
 
 /**
- * Signal handler that handles resize events.
- * This signal handler functions restart and
- * rerenders the GUI if a terminal resize event has
- * been detected.
- * @param signum Signal number
+ * Copies all staged windows into the screen grid.
+ * The staged windows are not flushed to the terminal, so no
+ * terminal output is generated.
  */
 void
-resize_win(int signum)
+headless_present(void)
 {
-    pthread_mutex_lock(&_win_lock);
-    stop_gui();
-    start_gui();
-    pthread_mutex_unlock(&_win_lock);
+    // newscr holds the screen as it would be shown by doupdate()
+    getyx(newscr, _headless.y_cursor, _headless.x_cursor);
+
+    for (int y = 0; y < _headless.rows; y++)
+    {
+        mvwin_wchnstr(newscr, y, 0, _headless.cells + y * _headless.cols,
+                      _headless.cols);
+    }
 }
 
 
 /**
- * Scroll a chat window up/downwards.
- * This functions scrolls a chat window n rows
- * up or downwards respectively. If n is positive
- * the window will be scrolled upwards otherwise it
- * will be scrolled down.
- * @param n number of rows to scroll up/down
+ * Writes the text of the headless screen grid to a file.
+ * Every row of the screen is written as one line without
+ * trailing blanks. A wide character takes a single cell of the
+ * grid, rows holding wide characters end with an empty cell.
+ * @param f File to write to
  */
 void
-scroll_win(DWINDOW_T* win, int n)
+snapshot_screen(FILE* f)
 {
-    // invert
-    n *= -1;
-
-    // up
-    if (n < 0)
+    wchar_t wch[CCHARW_MAX + 1];
+    char mb[MB_LEN_MAX];
+    cchar_t* row;
+    attr_t attrs;
+    short pair;
+    int len, end;
+    size_t n;
+
+    for (int y = 0; y < _headless.rows; y++)
     {
-        if (win->y_cursor > 0)
+        row = _headless.cells + y * _headless.cols;
+
+        for (end = 0, len = 0; end < _headless.cols; end++)
         {
-            set_row_cursor(win, win->y_cursor + n);
+            getcchar(&row[end], wch, &attrs, &pair, NULL);
+
+            if (wch[0] == L'\0')
+            {
+                break;
+            }
+
+            if (wch[0] != L' ')
+            {
+                len = end + 1;
+            }
         }
-    }
-    // down
-    else if (n > 0)
-    {
-        set_row_cursor(win, win->y_cursor + n);
-    }
 
-    // move to current cursor position
-    move_win(win, win->y_cursor, win->x_cursor);
-    refresh_screen();
-}
+        for (int x = 0; x < len; x++)
+        {
+            getcchar(&row[x], wch, &attrs, &pair, NULL);
 
+            for (int i = 0; wch[i] != L'\0'; i++)
+            {
+                if ((n = wcrtomb(mb, wch[i], NULL)) == (size_t) -1)
+                {
+                    mb[0] = WIDTH_INVALID;
+                    n = 1;
+                }
 
-/**
- * Moves to a certain position within a chat window.
- * This functions moves to a position within a chat window
- * and sets this window as current window.
- * @param win Pointer to chat window structure
- * @param y y position
- * @param x x position
- * @see DWINDOW_T of dchat-gui.h
- */
-void
-move_win(DWINDOW_T* win, int y, int x)
-{
-    wmove(win->win, y, x);
-    _win_cur = win;
+                fwrite(mb, 1, n, f);
+            }
+        }
+
+        fputc('\n', f);
+    }
 }
 
 
 /**
- * Sets the current active row position of a chat window.
- * @param win Pointer to chat window structure
- * @param y New row position
+ * Creates a ncurses window.
+ * This function creates a window and renders it on the screen.
+ * @see newwin() of ncurses.h
+ * @param height     height of window shown on the screen
+ * @param width      width of window shown on the screen
+ * @param starty     y position of window shown on the screen
+ * @param startx     x position of window shown on the screen
+ * @param col_bkgd   background color of window shown on the screen
+ * @return Pointer to ncurses window structure
  */
-void
-set_row_position(DWINDOW_T* win, int y)
+WINDOW*
+create_win(int height, int width, int starty, int startx, const int col_bkgd)
 {
-    if (y < 0)
-    {
-        y = 0;
-    }
-    else if (y > win->h_total)
+    WINDOW* local_win;
+    int attr = 0;
+    local_win = newwin(height, width, starty, startx);
+
+    // check if terminal support colors
+    if (has_colors())
     {
-        y = win->h_total;
+        wbkgd(local_win, COLOR_PAIR(col_bkgd));
     }
 
-    win->y_count = y;
-    set_row_cursor(win, y - win->h);
+    // render win
+    wrefresh(local_win);
+    return local_win;
 }
 
 
 /**
- * Sets the row cursor position of a chat window.
- * @param win Pointer to chat window structure
- * @param y New row cursor position
+ * Stages the contents of the current chat window for the next screen update.
  */
 void
-set_row_cursor(DWINDOW_T* win, int y)
+refresh_current()
+{
+    wnoutrefresh(_win_cur->win);
+}
+
+
+/**
+ * Schedules a redraw of all available chat windows.
+ * @see render_frame()
+ */
+void
+refresh_screen()
+{
+    _render.dirty |= (RENDER_STATUS << 1) - 1;
+}
+
+
+/**
+ * Marks a chat window as dirty.
+ * The window will be redrawn with the next frame.
+ * @param win Pointer to chat window structure
+ * @see render_frame()
+ */
+void
+mark_dirty(DWINDOW_T* win)
 {
-    if (y < 0)
+    int winnr;
+
+    for (winnr = 0; winnr < WINDOW_AMOUNT; winnr++)
     {
-        y = 0;
+        if (get_win(winnr) == win)
+        {
+            _render.dirty |= 1 << winnr;
+        }
     }
-    else if (y > win->y_count - win->h)
+}
+
+
+/**
+ * Sets the text of the status line.
+ * The status line will be redrawn with the next frame.
+ * @param fmt Format string of status text, NULL to clear the status line
+ * @param ... variable argumens
+ */
+void
+set_status(char* fmt, ...)
+{
+    va_list args;
+    _render.status[0] = '\0';
+
+    if (fmt != NULL)
     {
-        y = win->y_count - win->h;
+        va_start(args, fmt);
+        vsnprintf(_render.status, sizeof(_render.status), fmt, args);
+        va_end(args);
     }
 
-    win->y_cursor = y;
+    _render.dirty |= RENDER_STATUS;
 }
 
 
 /**
- * Increases/Decreases the current active column position of a chat window.
- * @param win Pointer to chat window structure
- * @param n Number of columns to add/subtract
+ * Sets the number of pending messages shown on the status line.
+ * The count has its own slot right of the status text, so that it does
+ * not replace a prompt shown there.
+ * @param count Number of pending messages, 0 hides the count
  */
 void
-col_position(DWINDOW_T* win, int n)
+set_pending(int count)
 {
-    int x_count_before = win->x_count;
-    win->x_count += n;
-
-    if (win->x_count > win->w -1)
+    if (_render.pending != count)
     {
-        win->x_count = win->w - 1;
+        _render.pending = count;
+        _render.dirty  |= RENDER_STATUS;
     }
-    else if (win->x_count < 0)
+}
+
+
+/**
+ * Sets the maximum number of frames rendered per second.
+ * @param fps Frames per second, values < 1 disable the frame cap
+ */
+void
+set_frame_rate(int fps)
+{
+    _render.frame_ival = fps > 0 ? 1000 / fps : 0;
+}
+
+
+/**
+ * Returns the time until the next frame has to be rendered.
+ * @return Milliseconds until next frame, -1 if no window is dirty
+ */
+int
+render_timeout()
+{
+    long long timeout;
+
+    if (!_render.dirty)
     {
-        win->x_count = 0;
+        return -1;
     }
 
-    // also set column cursor
-    col_cursor(win, win->x_count - x_count_before);
+    timeout = _render.last_frame + _render.frame_ival - now_ms();
+    return timeout < 0 ? 0 : timeout;
 }
 
 
 /**
- * Increases/Decreases the column cursor position of a chat window.
- * @param win Pointer to chat window structure
- * @param n Number of columns to add/subtract
+ * Stages the status line.
+ * The status text is drawn at the left, the number of pending messages
+ * at the right if it does not overlap the status text.
+ */
+void
+render_status()
+{
+    char pending[32];
+    int len;
+
+    werase(_win_sts);
+    mvwaddstr(_win_sts, 0, 0, _render.status);
+
+    if (_render.pending > 0)
+    {
+        len = snprintf(pending, sizeof(pending), "%d message(s) pending", _render.pending);
+
+        if (getcurx(_win_sts) + 1 + len <= getmaxx(_win_sts))
+        {
+            mvwaddstr(_win_sts, 0, getmaxx(_win_sts) - len, pending);
+        }
+    }
+}
+
+
+/**
+ * Renders a frame.
+ * All dirty chat windows are staged and presented at once by the render
+ * backend, so that many changes between two frames result in only one
+ * terminal update. The frame will be skipped if no window
+ * is dirty or if the frame cap has not elapsed since the last frame.
+ * @see set_frame_rate()
  */
 void
-col_cursor(DWINDOW_T* win, int n)
+render_frame()
+{
+    long long render_ns = 0;
+    int n = 0;
+
+    if (render_timeout() != 0)
+    {
+        return;
+    }
+
+    if (_render.dirty & (1 << WINDOW_MSG))
+    {
+        render_ns = now_ns();
+        n = drain_queue(&_queue, &_store, &_stats, &_hist);
+        render_view(&_view, &_store, _win_msg);
+        wnoutrefresh(_win_msg->win);
+    }
+
+    if (_render.dirty & (1 << WINDOW_USR))
+    {
+        render_roster(&_roster, _win_usr);
+        wnoutrefresh(_win_usr->win);
+    }
+
+    if (_render.dirty & (1 << WINDOW_INP))
+    {
+        render_editor(&_editor, _win_inp);
+        wnoutrefresh(_win_inp->win);
+    }
+
+    if (_render.dirty & RENDER_STATUS)
+    {
+        render_status();
+        wnoutrefresh(_win_sts);
+    }
+
+    // terminal cursor is placed within the window staged last
+    move_win(_win_cur, _win_cur->y_cursor, _win_cur->x_cursor);
+    refresh_current();
+
+    if (_stats.visible)
+    {
+        render_stats(&_stats);
+    }
+
+    _backend->present();
+
+    // messages moved into the store are on the screen now
+    if (n > 0)
+    {
+        record_latency(&_stats.render_flush, now_ns() - render_ns, n);
+    }
+
+    _render.dirty      = 0;
+    _render.last_frame = now_ms();
+}
+
+
+/**
+ * Returns the number of the current active chat window.
+ * @return value of enum colors
+ * @see enum colors in dchat-gui.h
+ */
+int
+current_winnr()
+{
+    if (_win_cur == _win_msg)
+    {
+        return WINDOW_MSG;
+    }
+
+    if (_win_cur == _win_usr)
+    {
+        return WINDOW_USR;
+    }
+
+    if (_win_cur == _win_inp)
+    {
+        return WINDOW_INP;
+    }
+
+    return -1;
+}
+
+
+/**
+ * Returns the currently active chat window.
+ * @return Pointer to the currently active chat window.
+ * @see enum windows in dchat-gui.h
+ */
+DWINDOW_T*
+get_win(int winnr)
 {
-    win->x_cursor += n;
+    if (winnr == WINDOW_MSG)
+    {
+        return _win_msg;
+    }
 
-    if (win->x_cursor > win->x_count)
+    if (winnr == WINDOW_USR)
     {
-        win->x_cursor = win->x_count;
+        return _win_usr;
     }
-    else if (win->x_cursor > win->w -1)
+
+    if (winnr == WINDOW_INP)
     {
-        win->x_cursor = win->w - 1;
+        return _win_inp;
     }
-    else if (win->x_cursor < 0)
+
+    return NULL;
+}
+
+
+/**
+ * Handles resize events of the terminal.
+ * SIGWINCH is received by the signalfd of the render scheduler, so
+ * resizing is done by the event loop like any other event. Several
+ * pending resize events are handled at once.
+ */
+void
+resize_win()
+{
+    struct signalfd_siginfo si;
+    struct winsize ws;
+
+    while (read(_render.sigfd, &si, sizeof(si)) == sizeof(si));
+
+    // the headless screen keeps its size
+    if (_backend != &_backend_term ||
+        ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1)
     {
-        win->x_cursor = 0;
+        return;
     }
+
+    resizeterm(ws.ws_row, ws.ws_col);
+    resize_gui();
 }
 
 
 /**
- * Reads keyboard hits until function key F1 has been typed.
+ * Moves to a certain position within a chat window.
+ * This functions moves to a position within a chat window
+ * and sets this window as current window.
+ * @param win Pointer to chat window structure
+ * @param y y position
+ * @param x x position
+ * @see DWINDOW_T of dchat-gui.h
  */
 void
+move_win(DWINDOW_T* win, int y, int x)
+{
+    wmove(win->win, y, x);
+    _win_cur = win;
+}
+
+
+/**
+ * Reads all keyboard hits available on the terminal.
+ * All keys are handled as one batch, and the windows they change are
+ * redrawn once with the next frame.
+ * @return 0 on success, -1 if function key F1 has been typed
+ */
+int
 read_input()
 {
+    int ch, ret = 0;
+
+    while ((ch = getch()) != ERR)
+    {
+        if (ch == KEY_F(1))
+        {
+            ret = -1;
+            break;
+        }
+
+        if (ch == KEY_PASTE)
+        {
+            read_paste();
+        }
+        else
+        {
+            handle_keyboard_hit(ch);
+        }
+    }
+
+    return ret;
+}
+
+
+/**
+ * Reads text pasted into the terminal (bracketed paste).
+ * Ncurses reads keyboard input byte by byte. Pasted text is read directly
+ * from standard input in chunks of PASTE_CHUNK bytes instead, up to
+ * PASTE_END. Bytes behind PASTE_END are handed back to ncurses. Line
+ * breaks and tabs are pasted as spaces, so that pasting never sends a
+ * message.
+ */
+void
+read_paste()
+{
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    char buf[PASTE_CHUNK];
+    size_t end_len = strlen(PASTE_END);
+    size_t matched = 0; // bytes of PASTE_END matched so far
+    ssize_t n;
     int ch;
 
-    while ((ch = getch()) != KEY_F(1))
+    // paste ends early if the terminal stops sending
+    while (poll(&pfd, 1, PASTE_TIMEOUT) == 1 &&
+           (n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
     {
-        pthread_mutex_lock(&_win_lock);
-        handle_keyboard_hit(ch);
-        pthread_mutex_unlock(&_win_lock);
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (buf[i] == PASTE_END[matched])
+            {
+                if (++matched < end_len)
+                {
+                    continue;
+                }
+
+                // next getch() returns the first byte pushed back last
+                while (n-- > i + 1)
+                {
+                    ungetch((unsigned char) buf[n]);
+                }
+
+                return;
+            }
+
+            // partial match of PASTE_END has been pasted text
+            for (size_t j = 0; j < matched; j++)
+            {
+                handle_keyboard_hit((unsigned char) PASTE_END[j]);
+            }
+
+            matched = buf[i] == PASTE_END[0];
+            ch = (unsigned char) buf[i];
+
+            if (!matched)
+            {
+                handle_keyboard_hit(ch == '\n' || ch == '\r' || ch == '\t' ? ' ' : ch);
+            }
+        }
     }
 }
 
@@ -586,6 +1115,13 @@ read_input()
 void
 handle_keyboard_hit(int ch)
 {
+    // keys are handled by the incremental search while it is active
+    if (_search.active)
+    {
+        on_search_key(ch);
+        return;
+    }
+
     switch (ch)
     {
         case KEY_STAB:
@@ -599,11 +1135,22 @@ handle_keyboard_hit(int ch)
             break;
 
         case KEY_BACKSPACE:
-        case KEY_DC:
         case 127: // BACKSPACE
             on_key_backspace();
             break;
 
+        case KEY_DC:
+            on_key_delete();
+            break;
+
+        case KEY_HOME:
+            on_key_home();
+            break;
+
+        case KEY_END:
+            on_key_end();
+            break;
+
         case KEY_UP:
             on_key_up();
             break;
@@ -628,6 +1175,14 @@ handle_keyboard_hit(int ch)
             on_key_right();
             break;
 
+        case KEY_F(2):
+            on_key_stats();
+            break;
+
+        case 18: // CTRL-R
+            on_key_search();
+            break;
+
         default:
             on_key_ascii(ch);
     }
@@ -661,35 +1216,38 @@ on_key_tab()
 
 /**
  * Handles enter key hits.
+ * Sends the line of the input editor and clears it.
  */
 void
 on_key_enter()
 {
-    int height, width, len, cur_row;
+    size_t len;
+    char* text = editor_text(&_editor, &len);
     char* input;
-    // get width of input window
-    getmaxyx(_win_inp->win, height, width);
-    // allocate memory for displayed input
-    input = malloc(width + 1);
 
-    if (input == NULL)
+    // allocate memory for line and newline
+    if ((input = malloc(len + 2)) == NULL)
     {
         exit(1);
     }
 
-    // fetch value of buffer from input window
-    mvwinnstr(_win_inp->win, 0, 0, input, _win_inp->x_count);
-    input[_win_inp->x_count]     = '\n'; // append newline
-    input[_win_inp->x_count + 1] = '\0';
+    memcpy(input, text, len);
+    input[len]     = '\n'; // append newline
+    input[len + 1] = '\0';
+
+    // write input to process via ipc, the line is kept within the editor
+    // if it cannot be queued
+    if (handle_sock_out(input, len + 1) == -1)
+    {
+        free(input);
+        return;
+    }
+
     // print value to message window
-    append_message(_win_msg, _nickname, MSGTYPE_SELF, input);
-    handle_sock_out(input); // write input to process via ipc
+    append_raw(_win_msg, _nickname, MSGTYPE_SELF, input, len + 1);
     free(input);
-    // reset column cursor
-    col_position(_win_inp, _win_inp->x_count * -1);
-    move_win(_win_inp, _win_inp->y_cursor, _win_inp->x_cursor);
-    // clear input window and refresh windows
-    werase(_win_inp->win);
+    editor_clear(&_editor);
+    move_win(_win_inp, _win_inp->y_cursor, 0);
     refresh_screen();
 }
 
@@ -700,15 +1258,50 @@ on_key_enter()
 void
 on_key_backspace()
 {
-    int y_pos, x_pos;
+    if (editor_delete(&_editor, -1) == 0)
+    {
+        mark_dirty(_win_inp);
+    }
+}
+
+
+/**
+ * Handles delete key hits.
+ */
+void
+on_key_delete()
+{
+    if (editor_delete(&_editor, 1) == 0)
+    {
+        mark_dirty(_win_inp);
+    }
+}
+
+
+/**
+ * Handles home key hits.
+ */
+void
+on_key_home()
+{
+    // the line has no more characters than bytes
+    if (editor_move(&_editor, -(long) editor_len(&_editor)) == 0)
+    {
+        mark_dirty(_win_inp);
+    }
+}
 
-    // if cursor is not at the most left position
-    if (_win_inp->x_cursor > 0)
+
+/**
+ * Handles end key hits.
+ */
+void
+on_key_end()
+{
+    // the line has no more characters than bytes
+    if (editor_move(&_editor, editor_len(&_editor)) == 0)
     {
-        getyx(_win_inp->win, y_pos, x_pos);
-        mvwdelch(_win_inp->win, y_pos, x_pos - 1);
-        wrefresh(_win_inp->win);
-        col_position(_win_inp, -1);
+        mark_dirty(_win_inp);
     }
 }
 
@@ -722,7 +1315,11 @@ on_key_up()
     if (current_winnr() == WINDOW_MSG)
     {
         // scroll window up 1 row
-        scroll_win(_win_msg, 1);
+        scroll_view(&_view, &_store, _win_msg, 1);
+    }
+    else if (current_winnr() == WINDOW_USR)
+    {
+        scroll_roster(&_roster, _win_usr, 1);
     }
 }
 
@@ -736,7 +1333,11 @@ on_page_up()
     if (current_winnr() == WINDOW_MSG)
     {
         // scroll window up 1 page
-        scroll_win(_win_msg, _win_msg->h);
+        scroll_view(&_view, &_store, _win_msg, _win_msg->h);
+    }
+    else if (current_winnr() == WINDOW_USR)
+    {
+        scroll_roster(&_roster, _win_usr, _win_usr->h);
     }
 }
 
@@ -750,7 +1351,11 @@ on_key_down()
     if (current_winnr() == WINDOW_MSG)
     {
         // move window down 1 row
-        scroll_win(_win_msg, -1);
+        scroll_view(&_view, &_store, _win_msg, -1);
+    }
+    else if (current_winnr() == WINDOW_USR)
+    {
+        scroll_roster(&_roster, _win_usr, -1);
     }
 }
 
@@ -764,7 +1369,11 @@ on_page_down()
     if (current_winnr() == WINDOW_MSG)
     {
         // move window down 1 page
-        scroll_win(_win_msg, _win_msg->h * -1);
+        scroll_view(&_view, &_store, _win_msg, _win_msg->h * -1);
+    }
+    else if (current_winnr() == WINDOW_USR)
+    {
+        scroll_roster(&_roster, _win_usr, _win_usr->h * -1);
     }
 }
 
@@ -775,15 +1384,9 @@ on_page_down()
 void
 on_key_left()
 {
-    int y_pos, x_pos;
-
-    // if cursor is not at the most left position
-    if (_win_inp->x_cursor > 0)
+    if (editor_move(&_editor, -1) == 0)
     {
-        getyx(_win_inp->win, y_pos, x_pos);
-        move_win(_win_inp, y_pos, x_pos - 1);
-        wrefresh(_win_inp->win);
-        col_cursor(_win_inp, -1);
+        mark_dirty(_win_inp);
     }
 }
 
@@ -794,633 +1397,4532 @@ on_key_left()
 void
 on_key_right()
 {
-    int y_pos, x_pos;
-    int y_mpos, x_mpos;
-    getyx(_win_inp->win, y_pos, x_pos);
-    getmaxyx(_win_inp->win, y_mpos, x_mpos);
-
-    if (x_pos < _win_inp->x_count && x_pos < x_mpos - 1)
+    if (editor_move(&_editor, 1) == 0)
     {
-        move_win(_win_inp, y_pos, x_pos + 1);
-        wrefresh(_win_inp->win);
-        col_cursor(_win_inp, 1);
+        mark_dirty(_win_inp);
     }
 }
 
 
 /**
- * Handles key hits that generate printable characters (ASCII).
+ * Handles key hits that generate printable characters.
+ * Characters beyond ASCII arrive as their UTF-8 bytes, which are
+ * inserted one by one.
  */
 void
 on_key_ascii(int ch)
 {
-    int height = 0, width = 0;
-    int max_height = 0, max_width = 0;
-    // get max width
-    getmaxyx(_win_inp->win, max_height, max_width);
-
-    if (_win_inp->x_count < _win_inp->w - 1 && ch >= 20 && ch <= 126)
+    if (((ch >= ' ' && ch <= '~') || (ch >= 0x80 && ch <= 0xff)) &&
+        editor_insert(&_editor, ch) == 0)
     {
-        // print character
-        winsch(_win_inp->win, ch);
-        // move 1 char right
-        getyx(_win_inp->win, height, width);
-        move_win(_win_inp, height, width + 1);
-        wrefresh(_win_inp->win);
-        // increase column cursor
-        col_position(_win_inp, 1);
+        mark_dirty(_win_inp);
     }
 }
 
 
 /**
- * Prints a string at the current cursor position in the given chat window.
- * This function prints a given string in the given chat window with the
- * specified attributes.
- * @param win  Pointer to chat window structure
- * @param str  String to print
- * @param attr Ncurses attributes applied to string
- * @return OK on success, ERR on failure
- * @see ncurses.h
+ * Handles function key F2 hits.
+ * Shows or hides the statistics overlay.
  */
-int
-print_string(DWINDOW_T* win, char* str, chtype attr)
+void
+on_key_stats()
 {
-    int len;
-    wattron(win->win, attr);
+    _stats.visible = !_stats.visible && _win_stats != NULL;
 
-    if (ERR == wprintw(win->win, "%s", str))
+    // message window has to restore the area of the overlay
+    if (!_stats.visible)
     {
-        return ERR;
+        touchwin(_win_msg->win);
     }
 
-    wattroff(win->win, attr);
-    wrefresh(win->win);
-    return OK;
+    refresh_screen();
 }
 
 
 /**
- * Prints a line at the current cursor position in the given chat window.
- * This function prints a given  message as chat line in the given chat window
- * and uses the colors specified for user input.
- * @param win  Pointer to chat window structure
- * @param nickname Nickname that will be print and that precedes the message.
- * @param msg  Message to print
- * @return OK on success, ERR on failure
- * @see ncurses.h
+ * Handles CTRL-R key hits.
+ * Starts an incremental search backwards through the message history.
  */
-int
-print_line_self(DWINDOW_T* win, char* nickname, char* msg)
+void
+on_key_search()
 {
-    return print_line(
-               win,
-               nickname, A_BOLD   | COLOR_PAIR(COLOR_NICKNAME_SELF),
-               msg,      A_NORMAL | COLOR_PAIR(COLOR_MESSAGE_SELF));
+    _search.active   = 1;
+    _search.len      = 0;
+    _search.query[0] = '\0';
+    _search.found    = 0;
+    _search.cand_len = 0;
+    _search.saved    = _view;
+    set_status("(reverse-i-search)`': ");
 }
 
 
 /**
- * Prints a line at the current cursor position in the given chat window.
- * This function prints a given  message as chat line in the given chat window
- * and uses the colors specified for received messages from contacts.
- * @param win  Pointer to chat window structure
- * @param nickname Nickname that will be print and that precedes the message.
- * @param msg  Message to print
- * @return OK on success, ERR on failure
- * @see ncurses.h
+ * Handles key hits while the incremental search is active.
+ * Printable characters extend the query, CTRL-R jumps to the next older
+ * match, ENTER accepts and CTRL-G or ESC cancels the search. Other keys
+ * accept the search and are handled as usual.
+ * @param ch keyboard key
  */
-int
-print_line_contact(DWINDOW_T* win, char* nickname, char* msg)
+void
+on_search_key(int ch)
 {
-    return print_line(
-               win,
-               nickname, A_BOLD   | COLOR_PAIR(COLOR_NICKNAME_CONTACT),
-               msg,      A_NORMAL | COLOR_PAIR(COLOR_MESSAGE_CONTACT));
+    switch (ch)
+    {
+        case 18: // CTRL-R
+            if (_search.found)
+            {
+                search_next(&_search, &_store, _search.match);
+            }
+
+            break;
+
+        case KEY_BACKSPACE:
+        case KEY_DC:
+        case 127: // BACKSPACE
+            if (_search.len > 0)
+            {
+                // continuation bytes are removed with their leading byte
+                do
+                {
+                    _search.len--;
+                }
+                while (_search.len > 0 &&
+                       (_search.query[_search.len] & 0xc0) == 0x80);
+
+                _search.query[_search.len] = '\0';
+                _search.cand_len = 0; // candidates of longer query
+                update_search(&_search, &_store);
+            }
+
+            break;
+
+        case 7:  // CTRL-G
+        case 27: // ESC
+            _search.active = 0;
+            _view = _search.saved;
+            mark_dirty(_win_msg);
+            set_status(NULL);
+            return;
+
+        case KEY_ENTER:
+        case 10: // ENTER
+            _search.active = 0;
+            set_status(NULL);
+            return;
+
+        default:
+            if ((ch < 32 || ch > 126) && (ch < 0x80 || ch > 0xff))
+            {
+                _search.active = 0;
+                set_status(NULL);
+                handle_keyboard_hit(ch);
+                return;
+            }
+
+            if (_search.len < SEARCH_LENGTH)
+            {
+                _search.query[_search.len++] = ch;
+                _search.query[_search.len]   = '\0';
+                update_search(&_search, &_store);
+            }
+    }
+
+    if (_search.found)
+    {
+        show_message(&_view, &_store, _win_msg, _search.match);
+    }
+
+    set_status("(%sreverse-i-search)`%s': ",
+               _search.found || _search.len == 0 ? "" : "failing ", _search.query);
 }
 
 
 /**
- * Prints a line at the current cursor position in the given chat window.
- * This function prints a given  message as chat line in the given chat window
- * and uses the colors specified for received messages from the system.
- * @param win  Pointer to chat window structure
- * @param nickname Nickname that will be print and that precedes the message.
- * @param msg  Message to print
- * @return OK on success, ERR on failure
- * @see ncurses.h
+ * Caches the display widths of the first WIDTH_CACHE code points.
+ * Widths depend on the locale, which has to be set before.
  */
-int
-print_line_system(DWINDOW_T* win, char* nickname, char* msg)
+void
+init_widths()
 {
-    return print_line(
-               win,
-               nickname, A_BOLD   | COLOR_PAIR(COLOR_NICKNAME_SYSTEM),
-               msg,      A_NORMAL | COLOR_PAIR(COLOR_MESSAGE_SYSTEM));
+    for (wchar_t wc = 0; wc < WIDTH_CACHE; wc++)
+    {
+        _widths[wc] = wcwidth(wc);
+    }
 }
 
 
 /**
- * Prints a line at the current cursor position in the given chat window.
- * This function prints a given  message as chat line in the given chat window.
- * Supported attributes can be manually defined for nickname and the message itself.
- * @param win  Pointer to chat window structure
- * @param nickname Nickname that will be print and that precedes the message.
- * @param nickname_attr Ncurses attributes for nickname
- * @param msg  Message to print
- * @param msg_attr Ncurses attributes for message
- * @return OK on success, ERR on failure
- * @see ncurses.h
+ * Returns the number of columns a character takes on the terminal.
+ * @param wc Character
+ * @return Number of columns, -1 if the character is not printable
  */
 int
-print_line(DWINDOW_T* win, char* nickname, chtype nickname_attr,  char* msg,
-           chtype msg_attr)
-{
-    int len = 0;
-    int ok  = OK;
-    time_t now = time (0);
-    char dt[100];
-    strftime (dt, 100, "%d. %b %Y %H:%M ", localtime (&now));
-    // print formatted chat line
-    wmove(win->win, win->y_count, 0);
-    ok += print_string(win, dt,        A_BOLD   | COLOR_PAIR(COLOR_DATE_TIME));
-    //ok += print_string(win, SEPARATOR, A_BOLD   | COLOR_PAIR(COLOR_SEPARATOR));
-    ok += print_string(win, "[",       nickname_attr);
-    ok += print_string(win, nickname,  nickname_attr);
-    ok += print_string(win, "]",       nickname_attr);
-    ok += print_string(win, PROMPT,    A_BOLD   | COLOR_PAIR(COLOR_SEPARATOR));
-    ok += print_string(win, msg,       msg_attr);
-    // append newline if non is given
-    len = strlen(msg);
-
-    if (msg[len - 1] != '\n')
-    {
-        ok += print_string(win, "\n\n",  msg_attr);
-    }
-    else
-    {
-        ok += print_string(win, "\n",  msg_attr);
-    }
-
-    return ok;
+char_width(wchar_t wc)
+{
+    return wc >= 0 && wc < WIDTH_CACHE ? _widths[wc] : wcwidth(wc);
 }
 
 
 /**
- * Appends a message to the given window.
- * This functions appends a text to the given window using the given nickname
- * and message. It uses the type parameter to determine the colors for the
- * message. Furthermore the window will be autoscrolled using a history buffer
- * (only works with ncurses pads).
- * @param win  Pointer to chat window structure
- * @param nickname Nickname that will be print and that precedes the message.
- * @param type Type of message (contact, self, system)
- * @param fmt Format string of message
- * @param args Argument of format string
- * @see enum msgtypes of dchat-gui.h
+ * Decodes the next character of UTF-8 encoded text.
+ * Invalid byte sequences and characters that are not printable are
+ * replaced by WIDTH_INVALID, so that they still take one column.
+ * @param s     Pointer to text
+ * @param len   Number of bytes of text, at least 1
+ * @param wc    Will contain the decoded character
+ * @param width Will contain the number of columns of the character
+ * @return Number of bytes of the character
  */
-void
-vappend_message(DWINDOW_T* win, char* nickname, int type, char* fmt,
-                va_list args)
+int
+next_char(const char* s, size_t len, wchar_t* wc, int* width)
 {
-    int ok = 0, page = 1;
-    int start, end;
-    int row_after, col_after;
-    va_list copy;
-    size_t  len;
-    char*   msg;
-    // copy format string arguments
-    va_copy(copy, args);
-    len = vsnprintf(0, 0, fmt, copy); // determine length of formatted string
-    va_end(copy);
+    static const wchar_t min[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    const unsigned char* u = (const unsigned char*) s;
+    wchar_t c = 0;
+    int n = 0;
 
-    if ((msg = malloc(len + 1)) != 0)
+    if (u[0] < 0x80)
     {
-        vsnprintf(msg, len+1, fmt, args);
+        n = 1;
+        c = u[0];
     }
-    else
+    else if (u[0] >= 0xc2 && u[0] < 0xf5)
     {
-        exit(1);
+        n = u[0] < 0xe0 ? 2 : u[0] < 0xf0 ? 3 : 4;
+        c = u[0] & (0x3f >> (n - 1));
     }
 
-    do
+    for (int i = 1; i < n; i++)
     {
-        switch (type)
+        if ((size_t) i >= len || (u[i] & 0xc0) != 0x80)
         {
-            case MSGTYPE_SELF:
-                ok = print_line_self(win, nickname, msg);
-                break;
-
-            case MSGTYPE_CONTACT:
-                ok = print_line_contact(win, nickname, msg);
-                break;
-
-            case MSGTYPE_SYSTEM:
-                ok = print_line_system(win, nickname, msg);
-                break;
-
-            default:
-                ok = print_line_self(win, nickname, msg);
-        }
-
-        if (ok == 0)
-        {
-            // adjust cursor position
-            getyx(win->win, row_after, col_after);
-            set_row_position(win, row_after);
+            n = 0;
             break;
         }
 
-        start = win->h * page;        // start copying from the second page
-        end   = win->y_count -
-                start; // end copying right before the line where the error occured
-        copywin(win->win, win->win, start, 0, 0, 0, end, win->w - 1, FALSE);
-        set_row_position(win, end);   // adjust cursor position
+        c = c << 6 | (u[i] & 0x3f);
     }
-    while (win->h * ++page < win->h_total); // retry if deleted page is not enough
 
-    refresh_screen();
+    // overlong forms, surrogates and code points beyond unicode are invalid
+    if (n == 0 || c < min[n] || (c >= 0xd800 && c < 0xe000) || c > 0x10ffff)
+    {
+        *wc    = WIDTH_INVALID;
+        *width = 1;
+        return 1;
+    }
+
+    if ((*width = char_width(c)) < 0)
+    {
+        c      = WIDTH_INVALID;
+        *width = 1;
+    }
+
+    *wc = c;
+    return n;
 }
 
 
 /**
- * Appends a message to the given window.
- * This functions appends a text to the given window using the given nickname
- * and message. It uses the type parameter to determine the colors for the
- * message. Furthermore the window will be autoscrolled using a history buffer
- * (only works with ncurses pads).
- * @param win  Pointer to chat window structure
- * @param nickname Nickname that will be print and that precedes the message.
- * @param type Type of message (contact, self, system)
- * @param fmt Format string of message
- * @param ... variable argumens
- * @see enum msgtypes of dchat-gui.h
+ * Draws a character beyond ASCII into a window.
+ * A character of width 0 is combined with the character left of it.
+ * @param win  Ncurses window to draw in
+ * @param y    Row of window
+ * @param x    Column of window
+ * @param wc   Character
+ * @param attr Attributes including the color pair of the character
  */
 void
-append_message(DWINDOW_T* win, char* nickname, int type, char* fmt, ...)
+draw_char(WINDOW* win, int y, int x, wchar_t wc, chtype attr)
 {
-    va_list args;
-    va_start(args, fmt);
-    vappend_message(win, nickname, type, fmt, args);
-    va_end(args);
+    wchar_t wstr[] = { wc, L'\0' };
+    cchar_t cc;
+
+    setcchar(&cc, wstr, attr & A_ATTRIBUTES & ~A_COLOR, PAIR_NUMBER(attr),
+             NULL);
+    mvwadd_wch(win, y, x, &cc);
 }
 
 
 /**
- * Appends a message to the given window (Thread-safe).
- * This functions thread-safely appends a text to the given window using the given nickname
- * and message. It uses the type parameter to determine the colors for the
- * message. Furthermore the window will be autoscrolled using a history buffer
- * (only works with ncurses pads).
- * @param win  Pointer to chat window structure
- * @param nickname Nickname that will be print and that precedes the message.
- * @param type Type of message (contact, self, system)
- * @param fmt Format string of message
- * @param ... variable argumens
- * @see enum msgtypes of dchat-gui.h
+ * Adds UTF-8 encoded text at the cursor of a window.
+ * Only the characters that fit into the given number of columns
+ * are added, using the attributes of the window.
+ * @param win Ncurses window to draw in, NULL to count columns only
+ * @param s   Pointer to text
+ * @param len Number of bytes of text
+ * @param w   Maximum number of columns
+ * @return Number of columns of the added characters
  */
-void
-append_message_sync(DWINDOW_T* win, char* nickname, int type, char* fmt, ...)
+int
+add_text(WINDOW* win, const char* s, size_t len, int w)
 {
-    va_list args;
-    pthread_mutex_lock(&_win_lock);
-    va_start(args, fmt);
-    // FIXME: use win instead -> but on resize_win -> segfault
-    vappend_message(_win_msg, nickname, type, fmt, args);
-    va_end(args);
-    pthread_mutex_unlock(&_win_lock);
+    wchar_t wc;
+    int col = 0, width, n;
+
+    for (size_t i = 0; i < len; i += n)
+    {
+        n = next_char(s + i, len - i, &wc, &width);
+
+        if (col + width > w)
+        {
+            break;
+        }
+
+        if (win != NULL && wc < 0x80)
+        {
+            waddch(win, wc);
+        }
+        else if (win != NULL)
+        {
+            draw_char(win, getcury(win), getcurx(win), wc, A_NORMAL);
+        }
+
+        col += width;
+    }
+
+    return col;
 }
 
 
 /**
- *  Read a line terminated with \\n from a file descriptor.
- *  Reads a line from the given file descriptor until \\n is found.
- *  @param fd   File descriptor to read from
- *  @param line Double pointer used for dynamic memory allocation since
- *              characters will be stored on the heap.
- *  @return: length of bytes read, 0 on EOF, -1 on error
+ * Returns the number of bytes of the characters next to the cursor of
+ * a line editor.
+ * Bytes of UTF-8 encoded characters are not separated.
+ * @param ed Pointer to line editor
+ * @param n  Number of UTF-8 encoded characters, negative values count
+ *           before the cursor, counts are limited to the line
+ * @return Number of bytes, negative before the cursor
  */
-int
-read_line(int fd, char** line)
+long
+editor_chars(EDITOR_T* ed, long n)
 {
-    char* ptr;             // line pointer
-    char* alc_ptr = NULL;  // used for realloc
-    int len = 1;           // current length of string (at least 1 char)
-    int ret;               // return value
-    *line = NULL;
+    size_t i;
 
-    do
+    if (n < 0)
     {
-        // allocate memory for new character
-        alc_ptr = realloc(*line, len + 1);
-
-        if (alc_ptr == NULL)
+        for (i = ed->gap; i > 0 && n < 0; n++)
         {
-            if (*line != NULL)
-            {
-                free(*line);
-            }
-
-            exit(1);
+            while (--i > 0 && (ed->buf[i] & 0xc0) == 0x80);
         }
 
-        *line = alc_ptr;
-        ptr = *line + len - 1;
-        len++;
+        return -(long) (ed->gap - i);
     }
-    while ((ret = read(fd, ptr, 1)) > 0 && *ptr != '\n');
 
-    // on error or EOF of read
-    if (ret <= 0)
+    for (i = ed->gap_end; i < ed->size && n > 0; n--)
     {
-        free(*line);
-        return ret;
+        while (++i < ed->size && (ed->buf[i] & 0xc0) == 0x80);
     }
 
-    // terminate string
-    *(ptr) = '\0';
-    return len - 1; // length of string excluding \0
+    return i - ed->gap_end;
 }
 
 
 /**
- *  Connects to a unix domain local socket.
- *  @param local_path Local socket path to connect to
- *  @return File descriptor or -1 on error
+ * Frees the buffer of a line editor.
+ * @param ed Pointer to line editor
+ */
+void
+free_editor(EDITOR_T* ed)
+{
+    free(ed->buf);
+    memset(ed, 0, sizeof(*ed));
+}
+
+
+/**
+ * Returns the length of the line of a line editor.
+ * @param ed Pointer to line editor
+ * @return Number of bytes, UTF-8 encoded characters may take several
+ */
+size_t
+editor_len(EDITOR_T* ed)
+{
+    return ed->size - (ed->gap_end - ed->gap);
+}
+
+
+/**
+ * Inserts a byte at the cursor of a line editor.
+ * The buffer is doubled if the gap is exhausted.
+ * Multibyte characters are inserted one byte after the other.
+ * @param ed Pointer to line editor
+ * @param ch Byte to insert
+ * @return 0 on success, -1 if the line has reached INPUT_MAX bytes
  */
 int
-unix_connect(char* local_path)
+editor_insert(EDITOR_T* ed, char ch)
 {
-    int fd;
-    char* error;
-    struct sockaddr_un unix_addr;
-    memset(&unix_addr, 0, sizeof(unix_addr));
-    unix_addr.sun_family = PF_LOCAL;
-    strcat(unix_addr.sun_path, local_path);
+    size_t size, tail;
+    char* alc_ptr;
 
-    if ((fd = socket(PF_LOCAL, SOCK_STREAM, 0)) == -1)
+    if (editor_len(ed) >= INPUT_MAX)
     {
         return -1;
     }
 
-    if (connect(fd, (struct sockaddr*) &unix_addr, sizeof(unix_addr)) == -1)
+    if (ed->gap == ed->gap_end)
     {
-        close(fd);
-        return -1;
+        size = ed->size > 0 ? ed->size * 2 : INPUT_INIT;
+        tail = ed->size - ed->gap_end;
+
+        if ((alc_ptr = realloc(ed->buf, size)) == NULL)
+        {
+            exit(1);
+        }
+
+        // text behind the cursor stays at the end of the buffer
+        memmove(alc_ptr + size - tail, alc_ptr + ed->gap_end, tail);
+        ed->buf     = alc_ptr;
+        ed->gap_end = size - tail;
+        ed->size    = size;
     }
 
-    return fd;
+    ed->buf[ed->gap++] = ch;
+    return 0;
 }
 
 
 /**
- *  Initializes the global inter process communication structure, used for this GUI.
- *  @return 0 on success, -1 otherwise
+ * Deletes characters before or behind the cursor of a line editor.
+ * @param ed Pointer to line editor
+ * @param n  Number of UTF-8 encoded characters, negative values delete
+ *           before the cursor
+ * @return 0 on success, -1 if there is nothing to delete
  */
 int
-init_ipc()
+editor_delete(EDITOR_T* ed, int n)
 {
-    memset(&_ipc, 0, sizeof(_ipc));
+    long m = editor_chars(ed, n);
 
-    // mutex for reconnect
-    if (pthread_mutex_init(&_ipc.lock, NULL) != 0)
+    if (m < 0)
     {
-        return -1;
+        ed->gap += m;
     }
-
-    // reconnect condition
-    if (pthread_cond_init(&_ipc.cond, NULL) != 0)
+    else
     {
-        return -1;
+        ed->gap_end += m;
     }
 
-    return 0;
+    return m != 0 ? 0 : -1;
 }
 
 
 /**
- *  Closes all open sockets of the global IPC structure.
+ * Moves the cursor of a line editor.
+ * The characters passed by the cursor are moved across the gap.
+ * @param ed Pointer to line editor
+ * @param n  Number of UTF-8 encoded characters, negative values move to
+ *           the left, the cursor stops at the start and end of the line
+ * @return 0 on success, -1 if the cursor has not been moved
  */
-void
-free_unix_socks()
+int
+editor_move(EDITOR_T* ed, long n)
 {
-    if (_ipc.inp_sock != 0)
-    {
-        close(_ipc.inp_sock);
-    }
+    long m = editor_chars(ed, n);
 
-    if (_ipc.out_sock != 0)
+    if (m < 0)
     {
-        close(_ipc.out_sock);
+        ed->gap     += m;
+        ed->gap_end += m;
+        memmove(ed->buf + ed->gap_end, ed->buf + ed->gap, -m);
     }
-
-    if (_ipc.log_sock != 0)
+    else
     {
-        close(_ipc.log_sock);
+        memmove(ed->buf + ed->gap, ed->buf + ed->gap_end, m);
+        ed->gap     += m;
+        ed->gap_end += m;
     }
+
+    return m != 0 ? 0 : -1;
 }
 
 
 /**
- *  Frees all ressources and closes all open sockets of the global IPC structure.
+ * Returns the line of a line editor as contiguous text.
+ * The gap is moved behind the end of the line.
+ * @param ed  Pointer to line editor
+ * @param len Will contain the length of the line
+ * @return Pointer to the line, not \0 terminated, valid until the line
+ *         is changed
  */
-void
-free_ipc()
+char*
+editor_text(EDITOR_T* ed, size_t* len)
 {
-    free_unix_socks();
-    pthread_mutex_destroy(&_ipc.lock);
-    pthread_cond_destroy(&_ipc.cond);
+    editor_move(ed, ed->size - ed->gap_end);
+    *len = ed->gap;
+    return ed->buf;
 }
 
 
 /**
- *  Signals the IPC thread to reconnect to the UI unix sockets.
+ * Clears the line of a line editor.
+ * @param ed Pointer to line editor
  */
 void
-signal_reconnect()
+editor_clear(EDITOR_T* ed)
 {
-    pthread_mutex_lock(&_ipc.lock);
-    _ipc.reconnect = 1;
-    pthread_cond_signal(&_ipc.cond);
-    pthread_mutex_unlock(&_ipc.lock);
+    ed->gap     = 0;
+    ed->gap_end = ed->size;
+    ed->scroll  = 0;
 }
 
 
 /**
- *  Thread function that handles incoming data from the input UI socket.
- *  @param ptr Not used
- *  @return NULL
+ * Draws the visible slice of the line of a line editor into a window.
+ * The window is scrolled horizontally, so that the cursor stays visible.
+ * Only the characters shown within the window are drawn.
+ * @param ed  Pointer to line editor
+ * @param win Pointer to chat window structure of the input window
  */
-void*
-handle_sock_inp(void* ptr)
+void
+render_editor(EDITOR_T* ed, DWINDOW_T* win)
 {
-    char* line;     // line read from socket fd
-    char* nickname;
-    char* msg;
-    char* save_ptr; // used for strtok
-    char delim = ';';
-    int has_nick = 0;
+    int w = win->w > 1 ? win->w : 1;
+    int before, after, width;
+    wchar_t wc;
 
-    // is input socket initialized; no EOF and no error?
-    while ( _ipc.inp_sock != 0 && read_line(_ipc.inp_sock, &line) > 0 )
+    if (ed->gap < ed->scroll)
     {
+        ed->scroll = ed->gap;
+    }
 
-        // split line: line format -> nickname;message
-        if ((nickname = strtok_r(line, &delim, &save_ptr)) == NULL)
-        {
-            free(line);
-            continue;
-        }
-
-        msg = save_ptr;
-        // first message contains a message form the dchat core which
-        // defines what nickname should be used
-        if (*msg == '\0' && !has_nick)
-        {
-            pthread_mutex_lock(&_win_lock);
-
-            if ((_nickname = malloc(strlen(nickname) + 1)) != NULL)
-            {
-                _nickname[0] = '\0';
-                strcat(_nickname, nickname);
-            }
-
-            has_nick = 1;
-            pthread_mutex_unlock(&_win_lock);
-
-            free(line);
-            continue;
-        }
+    // cursor is kept within the window, the last column is left for the
+    // cursor at the end of the line
+    before = add_text(NULL, ed->buf + ed->scroll, ed->gap - ed->scroll, INT_MAX);
 
-        append_message_sync(_win_msg, nickname, MSGTYPE_CONTACT, msg);
-        free(line);
+    while (before >= w)
+    {
+        ed->scroll += next_char(ed->buf + ed->scroll, ed->gap - ed->scroll,
+                                &wc, &width);
+        before -= width;
     }
 
-    // on error, eof, not initialized -> reconnect!
-    append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
-                        "No connection to input socket: '%s'", strerror(errno));
-    signal_reconnect();
-    pthread_exit(NULL);
+    werase(win->win);
+    wmove(win->win, 0, 0);
+    add_text(win->win, ed->buf + ed->scroll, ed->gap - ed->scroll, before);
+    after = add_text(win->win, ed->buf + ed->gap_end, ed->size - ed->gap_end,
+                     w - before);
+    win->x_cursor = before;
+    win->x_count  = before + after;
 }
 
 
 /**
- *  Thread function that handles outgoing data to the output UI socket.
- *  @param ptr Not used
- *  @return NULL
+ * Determines the ncurses attributes of a message.
+ * @param type          Type of message (contact, self, system)
+ * @param nickname_attr Will contain the attributes of the nickname
+ * @param msg_attr      Will contain the attributes of the message text
+ * @see enum msgtypes of dchat-gui.h
  */
-void*
-handle_sock_out(void* ptr)
+void
+message_attrs(int type, chtype* nickname_attr, chtype* msg_attr)
 {
-    int len;
-    len = strlen((char*)ptr);
-
-    // on error, eof, not initialized -> reconnect!
-    if (_ipc.out_sock == 0 || write(_ipc.out_sock, ptr, len) == -1)
+    switch (type)
     {
-        append_message(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
-                       "No connection to output socket: '%s'", strerror(errno));
-        signal_reconnect();
-    }
+        case MSGTYPE_CONTACT:
+            *nickname_attr = A_BOLD   | COLOR_PAIR(COLOR_NICKNAME_CONTACT);
+            *msg_attr      = A_NORMAL | COLOR_PAIR(COLOR_MESSAGE_CONTACT);
+            break;
 
-    return NULL;
+        case MSGTYPE_SYSTEM:
+            *nickname_attr = A_BOLD   | COLOR_PAIR(COLOR_NICKNAME_SYSTEM);
+            *msg_attr      = A_NORMAL | COLOR_PAIR(COLOR_MESSAGE_SYSTEM);
+            break;
+
+        case MSGTYPE_SELF:
+        default:
+            *nickname_attr = A_BOLD   | COLOR_PAIR(COLOR_NICKNAME_SELF);
+            *msg_attr      = A_NORMAL | COLOR_PAIR(COLOR_MESSAGE_SELF);
+    }
 }
 
 
 /**
- *  Thread function that handles incoming data from the logging UI socket.
- *  @param ptr Not used
- *  @return NULL
+ * Formats the date of a message.
+ * Since the formatted date only changes once a minute, the formatted dates
+ * of the last used minutes are cached. The cache is thread-local, so this
+ * function may be called by any thread. The length of the formatted date
+ * depends on the locale, a date not fitting into DATE_SIZE bytes is
+ * left empty.
+ * @param time Time to format
+ * @param dt   Buffer of at least DATE_SIZE bytes for the formatted date
+ * @return Length of the formatted date
+ * @see DATE_FORMAT of dchat-gui.h
  */
-void*
-handle_sock_log(void* ptr)
+size_t
+format_date(time_t time, char* dt)
 {
-    char* line;
+    static _Thread_local DATECACHE_T cache[DATE_CACHE];
+    time_t minute = time / 60;
+    DATECACHE_T* entry = &cache[minute % DATE_CACHE];
+    struct tm tm;
 
-    // is logging socket initialized; no EOF and no error?
-    while ( _ipc.log_sock != 0 && read_line(_ipc.log_sock, &line) > 0 )
+    if (!entry->valid || entry->minute != minute)
     {
-        append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM, line);
-        free(line);
+        localtime_r(&time, &tm);
+        // contents of the buffer are undefined if the date does not fit
+        if ((entry->len = strftime(entry->dt, sizeof(entry->dt), DATE_FORMAT, &tm)) == 0)
+        {
+            entry->dt[0] = '\0';
+        }
+
+        entry->minute = minute;
+        entry->valid  = 1;
     }
 
-    // on error, eof, not initialized -> reconnect!
-    append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
-                        "No connection to logging socket: '%s'", strerror(errno));
-    signal_reconnect();
-    pthread_exit(NULL);
+    memcpy(dt, entry->dt, entry->len + 1);
+    return entry->len;
 }
 
 
 /**
- *  Thread function that handles the connections to the UI unix sockets.
- *  @param ptr Not used
- *  @return NULL
+ * Splits a message record into the segments of a chat line.
+ * A chat line consists of date, nickname, prompt and message text, each
+ * having its own attributes: "<date>[<nickname>]$\\n<message>\\n\\n"
+ * @param msg Pointer to message record
+ * @param dt  Buffer of at least DATE_SIZE bytes for the formatted date
+ * @param seg Array of at least MSG_SEGMENTS segments
+ * @return Number of segments
  */
-void*
-th_ipc_connector(void* ptr)
+int
+message_segments(MSG_T* msg, char* dt, SEGMENT_T* seg)
 {
-    int ival = 5;
+    chtype nickname_attr, msg_attr;
+    size_t dt_len = format_date(msg->time, dt);
+    int n = 0;
+    message_attrs(msg->type, &nickname_attr, &msg_attr);
+    seg[n++] = (SEGMENT_T) { dt,            dt_len,                A_BOLD | COLOR_PAIR(COLOR_DATE_TIME) };
+    seg[n++] = (SEGMENT_T) { "[",           1,                     nickname_attr };
+    seg[n++] = (SEGMENT_T) { msg->nickname, strlen(msg->nickname), nickname_attr };
+    seg[n++] = (SEGMENT_T) { "]",           1,                     nickname_attr };
+    seg[n++] = (SEGMENT_T) { PROMPT,        strlen(PROMPT),        A_BOLD | COLOR_PAIR(COLOR_SEPARATOR) };
+    seg[n++] = (SEGMENT_T) { msg->text,     msg->len,              msg_attr };
+
+    // append newline if non is given
+    if (msg->len == 0 || msg->text[msg->len - 1] != '\n')
+    {
+        seg[n++] = (SEGMENT_T) { "\n\n", 2, msg_attr };
+    }
+    else
+    {
+        seg[n++] = (SEGMENT_T) { "\n",   1, msg_attr };
+    }
+
+    return n;
+}
+
+
+/**
+ * Builds the cell run of the chat line of a message record.
+ * Every character becomes one cell with the attributes of its segment
+ * already applied. ASCII is taken without decoding, characters beyond
+ * are decoded from UTF-8. Characters of width 0 are combined with the
+ * character of the previous cell, control characters are replaced to
+ * keep the layout. Spaces are marked with RUN_SPACE as word boundaries.
+ * @param msg Pointer to message record
+ * @return Pointer to cell run, freed by the caller
+ */
+RUN_T*
+build_run(MSG_T* msg)
+{
+    SEGMENT_T seg[MSG_SEGMENTS];
+    char dt[DATE_SIZE];
+    int nseg = message_segments(msg, dt, seg);
+    wchar_t wstr[CCHARW_MAX + 1];
+    size_t size = 0;
+    RUN_T* run;
+    attr_t attrs;
+    short pair;
+    int width, len, k;
+    unsigned char ch;
+    wchar_t wc;
+
+    // a chat line has at most one cell and one row per byte
+    for (int i = 0; i < nseg; i++)
+    {
+        size += seg[i].len;
+    }
+
+    if ((run = malloc(sizeof(*run) + size * (sizeof(cchar_t) + sizeof(int) + 1)))
+        == NULL)
+    {
+        exit(1);
+    }
+
+    run->starts = (int*) (run->cells + size);
+    run->widths = (unsigned char*) (run->starts + size);
+    run->len      = 0;
+    run->w        = 0;
+    run->nick_col = 0;
+
+    for (int i = 0; i < nseg; i++)
+    {
+        for (size_t j = 0; j < seg[i].len; j += len)
+        {
+            ch  = seg[i].str[j];
+            len = 1;
+
+            if (ch == '\n')
+            {
+                run->widths[run->len++] = 0;
+                continue;
+            }
+
+            if (ch < 0x80)
+            {
+                wc    = ch < ' ' || ch == 0x7f ? WIDTH_INVALID : ch;
+                width = 1;
+            }
+            else
+            {
+                len = next_char(seg[i].str + j, seg[i].len - j, &wc, &width);
+            }
+
+            if (width == 0)
+            {
+                // nothing to combine with at the beginning of a line
+                if (run->len > 0 && run->widths[run->len - 1] > 0)
+                {
+                    getcchar(&run->cells[run->len - 1], wstr, &attrs, &pair, NULL);
+
+                    if ((k = wcslen(wstr)) < CCHARW_MAX)
+                    {
+                        wstr[k]     = wc;
+                        wstr[k + 1] = L'\0';
+                        setcchar(&run->cells[run->len - 1], wstr, attrs, pair, NULL);
+                    }
+                }
+
+                continue;
+            }
+
+            wstr[0] = wc;
+            wstr[1] = L'\0';
+            setcchar(&run->cells[run->len], wstr,
+                     seg[i].attr & A_ATTRIBUTES & ~A_COLOR,
+                     PAIR_NUMBER(seg[i].attr), NULL);
+            run->widths[run->len++] = width | (ch == ' ' ? RUN_SPACE : 0);
+
+            // the nickname follows the date
+            if (i == 0)
+            {
+                run->nick_col += width;
+            }
+        }
+    }
+
+    return run;
+}
+
+
+/**
+ * Returns the cell run of a message record of a store.
+ * The run is built once and cached with the message record, so
+ * redrawing or scrolling over the message does not format it again.
+ * @param store Pointer to message store holding the message
+ * @param msg   Pointer to message record
+ * @return Pointer to cell run
+ */
+RUN_T*
+message_run(MSGSTORE_T* store, MSG_T* msg)
+{
+    if (msg->run == NULL)
+    {
+        msg->run = build_run(msg);
+        store->run_cells += msg->run->len;
+    }
+
+    return msg->run;
+}
+
+
+/**
+ * Lays out the cell run of a chat line for a window width.
+ * Rows are wrapped at word boundaries, which are spaces and both sides
+ * of wide characters. Words longer than a row are wrapped within. Spaces
+ * at a wrap are dropped, and the continuation rows of a line hang under
+ * the nickname as long as this leaves at least half of the width. The
+ * rows are kept until the run is laid out for another width.
+ * @param run Pointer to cell run of chat line
+ * @param w   Width of window
+ */
+void
+layout_run(RUN_T* run, int w)
+{
+    int i = 0, j, col, brk, width;
+
+    if (run->w == w)
+    {
+        return;
+    }
+
+    run->w    = w;
+    run->hang = run->nick_col <= w / 2 ? run->nick_col : 0;
+    run->rows = 0;
+
+    while (i < run->len)
+    {
+        run->starts[run->rows++] = i;
+        col = i > 0 && run->widths[i - 1] != 0 ? run->hang : 0;
+        brk = i;
+
+        for (j = i; j < run->len && run->widths[j] != 0; j++)
+        {
+            // characters wider than the window are replaced
+            if ((width = run->widths[j] & ~RUN_SPACE) > w)
+            {
+                width = 1;
+            }
+
+            if (col + width > w)
+            {
+                break;
+            }
+
+            if (width == 2 && j > i)
+            {
+                brk = j;
+            }
+
+            col += width;
+
+            if ((run->widths[j] & RUN_SPACE) || width == 2)
+            {
+                brk = j + 1;
+            }
+        }
+
+        // line ends within the row
+        if (j == run->len || run->widths[j] == 0)
+        {
+            i = j + 1;
+            continue;
+        }
+
+        i = brk > i ? brk : j;
+
+        while (i < run->len && (run->widths[i] & RUN_SPACE))
+        {
+            i++;
+        }
+
+        // line ends with the wrap
+        if (i < run->len && run->widths[i] == 0)
+        {
+            i++;
+        }
+    }
+}
+
+
+/**
+ * Draws cells of a run into a row of a window.
+ * @param win   Ncurses window to draw in
+ * @param run   Pointer to cell run
+ * @param start Index of first cell
+ * @param end   Index after last cell
+ * @param x     Column of window to draw the first cell in
+ * @param w     Width of window
+ * @param y     Row of window
+ */
+void
+draw_cells(WINDOW* win, RUN_T* run, int start, int end, int x, int w, int y)
+{
+    wchar_t wstr[CCHARW_MAX + 1];
+    attr_t attrs;
+    short pair;
+
+    // character wider than the whole window
+    if (end - start == 1 && (run->widths[start] & ~RUN_SPACE) > w - x)
+    {
+        getcchar(&run->cells[start], wstr, &attrs, &pair, NULL);
+        mvwaddch(win, y, x, WIDTH_INVALID | attrs | COLOR_PAIR(pair));
+    }
+    else if (end > start)
+    {
+        mvwadd_wchnstr(win, y, x, &run->cells[start], end - start);
+    }
+}
+
+
+/**
+ * Draws rows of the cell run of a chat line into a window.
+ * The run is laid out for the given width by layout_run(). Only the rows
+ * [row, row + n) of the chat line are drawn, starting at row y of the
+ * window. Each row is copied into the window at once.
+ * @param win Ncurses window to draw in, NULL to count rows only
+ * @param run Pointer to cell run of chat line
+ * @param w   Width of window
+ * @param row First row of the chat line to draw
+ * @param y   Row of window to draw the first row in
+ * @param n   Number of rows to draw
+ * @return Total number of rows of the chat line
+ */
+int
+draw_message(WINDOW* win, RUN_T* run, int w, int row, int y, int n)
+{
+    int start, end;
+    layout_run(run, w);
+
+    for (int r = row; win != NULL && r < run->rows && r < row + n; r++)
+    {
+        start = run->starts[r];
+        end   = r + 1 < run->rows ? run->starts[r + 1] : run->len;
+
+        // line break and spaces at the end of the row are not drawn
+        while (end > start &&
+               (run->widths[end - 1] == 0 || (run->widths[end - 1] & RUN_SPACE)))
+        {
+            end--;
+        }
+
+        draw_cells(win, run, start, end,
+                   start > 0 && run->widths[start - 1] != 0 ? run->hang : 0, w,
+                   y + r - row);
+    }
+
+    return run->rows;
+}
+
+
+/**
+ * Returns the number of rows a message record occupies in a window.
+ * @param store Pointer to message store holding the message
+ * @param msg   Pointer to message record
+ * @param w     Width of window
+ * @return Number of rows
+ */
+int
+message_rows(MSGSTORE_T* store, MSG_T* msg, int w)
+{
+    return draw_message(NULL, message_run(store, msg), w, 0, 0, 0);
+}
+
+
+/**
+ * Returns the index of the message shown in the top row of a view.
+ * Messages that have been dropped from the store will be replaced by
+ * the oldest message.
+ * @param view  Pointer to message view
+ * @param store Pointer to message store
+ * @return Index of message within the store
+ */
+size_t
+view_index(MSGVIEW_T* view, MSGSTORE_T* store)
+{
+    if (view->seq < store->seq)
+    {
+        view->seq = store->seq;
+        view->row = 0;
+    }
+
+    return view->seq - store->seq;
+}
+
+
+/**
+ * Moves a view to the newest messages of the store.
+ * The top row of the view will be set, so that the last row of the
+ * newest message is shown in the last row of the window.
+ * @param view  Pointer to message view
+ * @param store Pointer to message store
+ * @param win   Pointer to chat window structure showing the view
+ */
+void
+view_bottom(MSGVIEW_T* view, MSGSTORE_T* store, DWINDOW_T* win)
+{
+    size_t i = store->count;
+    int need = win->h;
+    int rows;
+    view->seq = store->seq;
+    view->row = 0;
+
+    while (i-- > 0)
+    {
+        rows = message_rows(store, get_message(store, i), win->w);
+
+        if (rows >= need)
+        {
+            view->seq = store->seq + i;
+            view->row = rows - need;
+            return;
+        }
+
+        need -= rows;
+    }
+}
+
+
+/**
+ * Scrolls a view up/downwards.
+ * If n is positive the view will be scrolled upwards otherwise it
+ * will be scrolled down. If the view is scrolled down to the newest
+ * messages, it will follow new messages again.
+ * @param view  Pointer to message view
+ * @param store Pointer to message store
+ * @param win   Pointer to chat window structure showing the view
+ * @param n     Number of rows to scroll up/down
+ */
+void
+scroll_view(MSGVIEW_T* view, MSGSTORE_T* store, DWINDOW_T* win, int n)
+{
+    size_t i;
+    int rows, step;
+
+    if (store->count == 0)
+    {
+        return;
+    }
+
+    if (view->follow)
+    {
+        view_bottom(view, store, win);
+    }
+
+    i = view_index(view, store);
+    view->follow = 0;
+
+    // up
+    while (n > 0)
+    {
+        if (view->row > 0)
+        {
+            step = view->row < n ? view->row : n;
+            view->row -= step;
+            n -= step;
+        }
+        else if (i > 0)
+        {
+            i--;
+            view->row = message_rows(store, get_message(store, i), win->w) - 1;
+            n--;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // down
+    while (n < 0 && i < store->count)
+    {
+        rows = message_rows(store, get_message(store, i), win->w);
+
+        if (view->row - n < rows)
+        {
+            view->row -= n;
+            n = 0;
+        }
+        else
+        {
+            n += rows - view->row;
+            view->row = 0;
+            i++;
+        }
+    }
+
+    view->seq = store->seq + i;
+    // follow new messages if less than one page is left below the view
+    rows = -view->row;
+
+    while (i < store->count && rows <= win->h)
+    {
+        rows += message_rows(store, get_message(store, i++), win->w);
+    }
+
+    if (rows <= win->h)
+    {
+        view->follow = 1;
+    }
+
+    mark_dirty(win);
+}
+
+
+/**
+ * Renders the visible rows of a view into its chat window.
+ * Only the messages shown within the window are laid out and drawn,
+ * so the costs do not depend on the size of the message history.
+ * Cached cell runs of messages far from the view are freed once the
+ * store exceeds RUN_CACHE_CELLS.
+ * @param view  Pointer to message view
+ * @param store Pointer to message store
+ * @param win   Pointer to chat window structure showing the view
+ */
+void
+render_view(MSGVIEW_T* view, MSGSTORE_T* store, DWINDOW_T* win)
+{
+    size_t i, first;
+    int y = 0, row;
+
+    if (view->follow)
+    {
+        view_bottom(view, store, win);
+    }
+
+    i   = first = view_index(view, store);
+    row = view->row;
+    werase(win->win);
+
+    while (y < win->h && i < store->count)
+    {
+        y  += draw_message(win->win, message_run(store, get_message(store, i++)),
+                           win->w, row, y, win->h - y) - row;
+        row = 0;
+    }
+
+    if (store->run_cells > RUN_CACHE_CELLS)
+    {
+        trim_runs(store, first, i);
+    }
+}
+
+
+/**
+ * Appends a message to the given window.
+ * This functions appends a text to the given window using the given nickname
+ * and message. It uses the type parameter to determine the colors for the
+ * message. The message is queued and moved into the message store with the
+ * next frame, the window is only a view of the store.
+ * Must only be called by the thread running the event loop.
+ * @param win  Pointer to chat window structure
+ * @param nickname Nickname that will be print and that precedes the message.
+ * @param type Type of message (contact, self, system)
+ * @param fmt Format string of message
+ * @param args Argument of format string
+ * @see enum msgtypes of dchat-gui.h
+ */
+void
+vappend_message(DWINDOW_T* win, char* nickname, int type, char* fmt,
+                va_list args)
+{
+    push_message(&_queue, vformat_qmsg(nickname, type, fmt, args));
+    mark_dirty(win);
+}
+
+
+/**
+ * Appends an already formatted message to the given window.
+ * Unlike append_message(), the text is no format string. It is copied
+ * once into the queue node, which is taken over by the message store.
+ * Must only be called by the thread running the event loop.
+ * @param win  Pointer to chat window structure
+ * @param nickname Nickname that will be print and that precedes the message.
+ * @param type Type of message (contact, self, system)
+ * @param text Text of message, need not be \0 terminated
+ * @param len  Length of text
+ * @see enum msgtypes of dchat-gui.h
+ */
+void
+append_raw(DWINDOW_T* win, char* nickname, int type, char* text, size_t len)
+{
+    push_message(&_queue, new_qmsg(nickname, type, text, len, 0));
+    mark_dirty(win);
+}
+
+
+/**
+ * Appends a message to the given window.
+ * This functions appends a text to the given window using the given nickname
+ * and message. It uses the type parameter to determine the colors for the
+ * message. Must only be called by the thread running the event loop.
+ * @param win  Pointer to chat window structure
+ * @param nickname Nickname that will be print and that precedes the message.
+ * @param type Type of message (contact, self, system)
+ * @param fmt Format string of message
+ * @param ... variable argumens
+ * @see enum msgtypes of dchat-gui.h
+ */
+void
+append_message(DWINDOW_T* win, char* nickname, int type, char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vappend_message(win, nickname, type, fmt, args);
+    va_end(args);
+}
+
+
+/**
+ * Appends many messages to the given window at once.
+ * The messages are pushed into the message queue as one chain, so the
+ * queue is updated and the window is marked dirty only once. They are
+ * moved into the message store and drawn with the next frame.
+ * Must only be called by the thread running the event loop.
+ * @param win   Pointer to chat window structure
+ * @param nodes Queue nodes of messages in the order to append them
+ * @param n     Number of messages
+ */
+void
+append_messages(DWINDOW_T* win, QMSG_T** nodes, size_t n)
+{
+    if (n > 0)
+    {
+        push_messages(&_queue, nodes, n);
+        mark_dirty(win);
+    }
+}
+
+
+/**
+ * Appends a message to the message window (Thread-safe).
+ * This functions thread-safely appends a text to the message window using
+ * the given nickname and message. The message is pushed into the lock-free
+ * message queue and the event loop is woken up, so that the calling thread
+ * never touches ncurses, which is only used by the event loop.
+ * @param win  Not used, messages are always shown in the message window
+ * @param nickname Nickname that will be print and that precedes the message.
+ * @param type Type of message (contact, self, system)
+ * @param fmt Format string of message
+ * @param ... variable argumens
+ * @see enum msgtypes of dchat-gui.h
+ */
+void
+append_message_sync(DWINDOW_T* win, char* nickname, int type, char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    push_message(&_queue, vformat_qmsg(nickname, type, fmt, args));
+    va_end(args);
+    wakeup_queue(&_queue);
+}
+
+
+/**
+ * Initializes a lock-free message queue.
+ * @param q     Pointer to message queue
+ * @param drain Maximum number of messages drained per frame, 0 for no limit
+ * @return 0 on success, -1 otherwise
+ */
+int
+init_queue(MSGQUEUE_T* q, int drain)
+{
+    memset(q, 0, sizeof(*q));
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    atomic_init(&q->len, 0);
+    q->tail  = &q->stub;
+    q->drain = drain;
+
+    if ((q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Frees all queued messages and the eventfd of a message queue.
+ * @param q Pointer to message queue
+ */
+void
+free_queue(MSGQUEUE_T* q)
+{
+    QMSG_T* node;
+
+    while ((node = pop_message(q)) != NULL)
+    {
+        free(node);
+    }
+
+    close(q->efd);
+}
+
+
+/**
+ * Allocates a queue node for a message.
+ * The nickname is copied into the node, the text of the message has to
+ * be written by the caller into the buffer of len + 1 bytes the text of
+ * the returned message record points to.
+ * @param nickname Nickname of the sender of the message
+ * @param type     Type of message (contact, self, system)
+ * @param len      Length of the text of the message
+ * @param time     Time the message has been sent, 0 for the current time
+ * @return Pointer to queue node
+ */
+QMSG_T*
+alloc_qmsg(char* nickname, int type, size_t len, time_t time)
+{
+    QMSG_T* node;
+    size_t nick_len = strlen(nickname);
+
+    // node, nickname and text share one allocation
+    if ((node = malloc(sizeof(*node) + nick_len + len + 2)) == NULL)
+    {
+        exit(1);
+    }
+
+    node->recv_ns      = 0;
+    node->msg.mem      = node; // taken over by the message store
+    node->msg.nickname = (char*) (node + 1);
+    node->msg.text     = node->msg.nickname + nick_len + 1;
+    node->msg.len      = len;
+    node->msg.type     = type;
+    node->msg.time     = time != 0 ? time : now();
+    node->msg.run      = NULL;
+    memcpy(node->msg.nickname, nickname, nick_len + 1);
+    return node;
+}
+
+
+/**
+ * Allocates a queue node for a message with the given text.
+ * @param nickname Nickname of the sender of the message
+ * @param type     Type of message (contact, self, system)
+ * @param text     Text of message
+ * @param len      Length of text
+ * @param time     Time the message has been sent, 0 for the current time
+ * @return Pointer to queue node
+ */
+QMSG_T*
+new_qmsg(char* nickname, int type, char* text, size_t len, time_t time)
+{
+    QMSG_T* node = alloc_qmsg(nickname, type, len, time);
+    memcpy(node->msg.text, text, len);
+    node->msg.text[len] = '\0';
+    return node;
+}
+
+
+/**
+ * Allocates a queue node for a message with a formatted text.
+ * @param nickname Nickname of the sender of the message
+ * @param type     Type of message (contact, self, system)
+ * @param fmt      Format string of message
+ * @param args     Argument of format string
+ * @return Pointer to queue node
+ */
+QMSG_T*
+vformat_qmsg(char* nickname, int type, char* fmt, va_list args)
+{
+    QMSG_T* node;
+    va_list copy;
+    size_t  len;
+    // copy format string arguments
+    va_copy(copy, args);
+    len = vsnprintf(0, 0, fmt, copy); // determine length of formatted string
+    va_end(copy);
+    node = alloc_qmsg(nickname, type, len, 0);
+    vsnprintf(node->msg.text, len + 1, fmt, args);
+    return node;
+}
+
+
+/**
+ * Links a node at the head of a message queue.
+ * @param q    Pointer to message queue
+ * @param node Pointer to queue node
+ */
+void
+link_node(MSGQUEUE_T* q, QMSG_T* node)
+{
+    QMSG_T* prev;
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+
+/**
+ * Pushes a message into a message queue.
+ * Any thread may push messages at any time without locking.
+ * @param q    Pointer to message queue
+ * @param node Pointer to queue node
+ */
+void
+push_message(MSGQUEUE_T* q, QMSG_T* node)
+{
+    node->enq_ns = now_ns();
+    atomic_fetch_add_explicit(&q->len, 1, memory_order_relaxed);
+    link_node(q, node);
+}
+
+
+/**
+ * Pushes many messages into a message queue at once.
+ * The messages are linked among each other first, so the queue is
+ * updated only once for all of them. Any thread may push messages at
+ * any time without locking.
+ * @param q     Pointer to message queue
+ * @param nodes Queue nodes in the order to push them
+ * @param n     Number of queue nodes, at least 1
+ */
+void
+push_messages(MSGQUEUE_T* q, QMSG_T** nodes, size_t n)
+{
+    long long enq_ns = now_ns();
+    QMSG_T* prev;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        nodes[i]->enq_ns = enq_ns;
+        atomic_store_explicit(&nodes[i]->next, i + 1 < n ? nodes[i + 1] : NULL,
+                              memory_order_relaxed);
+    }
+
+    atomic_fetch_add_explicit(&q->len, n, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&q->head, nodes[n - 1], memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, nodes[0], memory_order_release);
+}
+
+
+/**
+ * Pops the oldest message of a message queue.
+ * Must only be called by the thread running the event loop. If a producer
+ * is about to push a message, this function may return NULL although the
+ * queue is not empty. This message will be popped with the next call.
+ * @param q Pointer to message queue
+ * @return Pointer to queue node, NULL if the queue is empty
+ */
+QMSG_T*
+pop_message(MSGQUEUE_T* q)
+{
+    QMSG_T* tail = q->tail;
+    QMSG_T* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    // skip stub node
+    if (tail == &q->stub)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+
+        q->tail = tail = next;
+        next    = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+
+    if (next != NULL)
+    {
+        q->tail = next;
+        atomic_fetch_sub_explicit(&q->len, 1, memory_order_relaxed);
+        return tail;
+    }
+
+    // a producer has not linked its node yet
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    // last node: reinsert stub node to be able to pop it
+    link_node(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (next != NULL)
+    {
+        q->tail = next;
+        atomic_fetch_sub_explicit(&q->len, 1, memory_order_relaxed);
+        return tail;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Returns the number of messages within a message queue.
+ * @param q Pointer to message queue
+ * @return Number of queued messages
+ */
+size_t
+queue_length(MSGQUEUE_T* q)
+{
+    return atomic_load_explicit(&q->len, memory_order_relaxed);
+}
+
+
+/**
+ * Wakes up the event loop to drain a message queue.
+ * Used by threads other than the one running the event loop.
+ * @param q Pointer to message queue
+ */
+void
+wakeup_queue(MSGQUEUE_T* q)
+{
+    uint64_t one = 1;
+
+    if (write(q->efd, &one, sizeof(one)) == -1)
+    {
+        // counter overflow: event loop is already woken up
+    }
+}
+
+
+/**
+ * Resets the wakeup counter of a message queue.
+ * Queued messages will be drained with the next frame.
+ * @param q Pointer to message queue
+ */
+void
+reset_wakeup(MSGQUEUE_T* q)
+{
+    uint64_t cnt;
+
+    if (read(q->efd, &cnt, sizeof(cnt)) == -1)
+    {
+        // no wakeup pending
+    }
+}
+
+
+/**
+ * Moves queued messages into the message store.
+ * At most the configured number of messages are moved per call, so that
+ * a flood of messages cannot stall the event loop.
+ * The latencies of moved messages are recorded within the statistics.
+ * @param q     Pointer to message queue
+ * @param store Pointer to message store
+ * @param stats Pointer to latency statistics, NULL to record nothing
+ * @param hist  Pointer to history the messages are logged to, NULL for none
+ * @return Number of moved messages
+ */
+int
+drain_queue(MSGQUEUE_T* q, MSGSTORE_T* store, STATS_T* stats,
+            HISTLOG_T* hist)
+{
+    MSG_T* msg;
+    QMSG_T* node;
+    long long render_ns = stats != NULL ? now_ns() : 0;
+    int n = 0;
+
+    while ((q->drain == 0 || n < q->drain) && (node = pop_message(q)) != NULL)
+    {
+        if (stats != NULL)
+        {
+            if (node->recv_ns != 0)
+            {
+                record_latency(&stats->recv_enq, node->enq_ns - node->recv_ns, 1);
+            }
+
+            record_latency(&stats->enq_render, render_ns - node->enq_ns, 1);
+        }
+
+        msg = adopt_message(store, node);
+
+        if (hist != NULL)
+        {
+            log_message(hist, msg);
+        }
+
+        n++;
+    }
+
+    if (hist != NULL && n > 0)
+    {
+        commit_history(hist);
+    }
+
+    return n;
+}
+
+
+/**
+ * Initializes a message store.
+ * @param store     Pointer to message store
+ * @param max_msgs  Maximum number of messages held, 0 for no limit
+ * @param max_bytes Maximum number of bytes of message texts held, 0 for no limit
+ */
+void
+init_store(MSGSTORE_T* store, size_t max_msgs, size_t max_bytes)
+{
+    memset(store, 0, sizeof(*store));
+    store->max_msgs  = max_msgs;
+    store->max_bytes = max_bytes;
+}
+
+
+/**
+ * Frees all messages of a message store.
+ * @param store Pointer to message store
+ */
+void
+free_store(MSGSTORE_T* store)
+{
+    while (store->count > 0)
+    {
+        drop_message(store);
+    }
+
+    free(store->msgs);
+    init_store(store, store->max_msgs, store->max_bytes);
+}
+
+
+/**
+ * Returns a message of a message store.
+ * @param store Pointer to message store
+ * @param i     Index of message, 0 is the oldest message
+ * @return Pointer to message record
+ */
+MSG_T*
+get_message(MSGSTORE_T* store, size_t i)
+{
+    return &store->msgs[(store->head + i) % store->size];
+}
+
+
+/**
+ * Removes the oldest message of a message store.
+ * @param store Pointer to message store
+ */
+void
+drop_message(MSGSTORE_T* store)
+{
+    MSG_T* msg = get_message(store, 0);
+    store->bytes -= msg->len;
+    free_run(store, msg);
+    free(msg->mem);
+    store->head = (store->head + 1) % store->size;
+    store->count--;
+    store->seq++;
+}
+
+
+/**
+ * Frees the cached cell run of a message record.
+ * @param store Pointer to message store holding the message
+ * @param msg   Pointer to message record
+ */
+void
+free_run(MSGSTORE_T* store, MSG_T* msg)
+{
+    if (msg->run != NULL)
+    {
+        store->run_cells -= msg->run->len;
+        free(msg->run);
+        msg->run = NULL;
+    }
+}
+
+
+/**
+ * Frees cached cell runs of a message store.
+ * Runs of the messages farthest from the given range are freed first,
+ * until the runs of the store hold at most half of RUN_CACHE_CELLS.
+ * Runs of the messages within the range are kept.
+ * @param store Pointer to message store
+ * @param first Index of first message to keep
+ * @param last  Index after last message to keep
+ */
+void
+trim_runs(MSGSTORE_T* store, size_t first, size_t last)
+{
+    size_t lo = 0, hi = store->count;
+
+    while (store->run_cells > RUN_CACHE_CELLS / 2 && (lo < first || hi > last))
+    {
+        if (first - lo >= hi - last)
+        {
+            free_run(store, get_message(store, lo++));
+        }
+        else
+        {
+            free_run(store, get_message(store, --hi));
+        }
+    }
+}
+
+
+/**
+ * Reserves the record of a new message at the end of a message store.
+ * Oldest messages will be dropped if the capacity of the store would be
+ * exceeded. The ring buffer of the store grows on demand until it
+ * reaches its maximum number of messages. The record becomes part of the
+ * store with commit_message().
+ * @param store Pointer to message store
+ * @param len   Length of text of the new message
+ * @return Pointer to the reserved message record
+ */
+MSG_T*
+reserve_message(MSGSTORE_T* store, size_t len)
+{
+    MSG_T* alc_ptr;
+    size_t size;
+
+    // drop oldest messages to make room for the new one
+    while (store->count > 0 &&
+           ((store->max_msgs > 0 && store->count >= store->max_msgs) ||
+            (store->max_bytes > 0 && store->bytes + len > store->max_bytes)))
+    {
+        drop_message(store);
+    }
+
+    // grow ring buffer
+    if (store->count == store->size)
+    {
+        size = store->size > 0 ? store->size * 2 : STORE_INIT_MSGS;
+
+        if (store->max_msgs > 0 && size > store->max_msgs)
+        {
+            size = store->max_msgs;
+        }
+
+        if ((alc_ptr = malloc(size * sizeof(*alc_ptr))) == NULL)
+        {
+            exit(1);
+        }
+
+        // unwrap ring buffer
+        for (size_t i = 0; i < store->count; i++)
+        {
+            alc_ptr[i] = *get_message(store, i);
+        }
+
+        free(store->msgs);
+        store->msgs = alc_ptr;
+        store->size = size;
+        store->head = 0;
+    }
+
+    return &store->msgs[(store->head + store->count) % store->size];
+}
+
+
+/**
+ * Adds the message record reserved last to a message store.
+ * @param store Pointer to message store
+ * @return Pointer to the stored message record
+ * @see reserve_message()
+ */
+MSG_T*
+commit_message(MSGSTORE_T* store)
+{
+    MSG_T* msg = &store->msgs[(store->head + store->count) % store->size];
+    store->bytes += msg->len;
+    store->count++;
+
+    if (store->index != NULL)
+    {
+        index_message(store->index, store, store->seq + store->count - 1, msg);
+    }
+
+    return msg;
+}
+
+
+/**
+ * Appends a queued message to a message store.
+ * The store takes over the allocation of the queue node, so the message
+ * is neither copied nor allocated again.
+ * @param store Pointer to message store
+ * @param node  Pointer to queue node, freed by the store
+ * @return Pointer to the stored message record
+ */
+MSG_T*
+adopt_message(MSGSTORE_T* store, QMSG_T* node)
+{
+    MSG_T* msg = reserve_message(store, node->msg.len);
+    *msg     = node->msg;
+    msg->mem = node;
+    return commit_message(store);
+}
+
+
+/**
+ * Appends a copy of a message to a message store.
+ * @param store    Pointer to message store
+ * @param time     Time the message has been received
+ * @param type     Type of message (contact, self, system)
+ * @param nickname Nickname of the sender of the message
+ * @param text     Text of message
+ * @param len      Length of text
+ * @return Pointer to the stored message record
+ * @see enum msgtypes of dchat-gui.h
+ */
+MSG_T*
+store_message(MSGSTORE_T* store, time_t time, int type, char* nickname,
+              char* text, size_t len)
+{
+    MSG_T* msg = reserve_message(store, len);
+    size_t nick_len = strlen(nickname);
+
+    // nickname and text share one allocation: <nickname>\0<text>\0
+    if ((msg->mem = msg->nickname = malloc(nick_len + len + 2)) == NULL)
+    {
+        exit(1);
+    }
+
+    memcpy(msg->nickname, nickname, nick_len + 1);
+    msg->text = msg->nickname + nick_len + 1;
+    memcpy(msg->text, text, len);
+    msg->text[len] = '\0';
+    msg->len  = len;
+    msg->time = time;
+    msg->type = type;
+    msg->run  = NULL;
+    return commit_message(store);
+}
+
+
+/**
+ * Frees a generation of the search index.
+ * @param gen Pointer to generation, may be NULL
+ */
+void
+free_trigrams(TRIGRAMS_T* gen)
+{
+    if (gen == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < 1 << INDEX_BITS; i++)
+    {
+        free(gen->lists[i].buf);
+    }
+
+    free(gen);
+}
+
+
+/**
+ * Frees all generations of a search index.
+ * @param index Pointer to search index
+ */
+void
+free_index(MSGINDEX_T* index)
+{
+    free_trigrams(index->gens[0]);
+    free_trigrams(index->gens[1]);
+    index->gens[0] = index->gens[1] = NULL;
+}
+
+
+/**
+ * Folds upper case ASCII characters to lower case.
+ * Unlike tolower(), this does not depend on the locale.
+ * @param c Character
+ * @return Folded character
+ */
+int
+fold_char(int c)
+{
+    return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+
+/**
+ * Returns the posting list of a trigram.
+ * Trigrams are case-insensitive.
+ * @param s Pointer to first of three characters
+ * @return Index of posting list
+ */
+unsigned int
+trigram_hash(const char* s)
+{
+    uint32_t t = (uint32_t) fold_char((unsigned char) s[0]) << 16 |
+                 (uint32_t) fold_char((unsigned char) s[1]) << 8 |
+                 (uint32_t) fold_char((unsigned char) s[2]);
+    return (t * 2654435761u) >> (32 - INDEX_BITS);
+}
+
+
+/**
+ * Appends a message block to a posting list.
+ * @param gen   Pointer to generation of search index
+ * @param hash  Trigram hash of posting list
+ * @param block Block number, not lower than the last one of the list
+ */
+void
+add_posting(TRIGRAMS_T* gen, unsigned int hash, unsigned long long block)
+{
+    POSTINGS_T* list = &gen->lists[hash];
+    unsigned long long delta;
+
+    // trigram occurs several times within block
+    if (gen->last[hash] == block + 1)
+    {
+        return;
+    }
+
+    delta = block - (gen->last[hash] > 0 ? gen->last[hash] - 1 :
+                     gen->first >> INDEX_BLOCK);
+
+    // a varint has at most 10 bytes
+    if (list->len + 10 > list->size)
+    {
+        list->size = list->size > 0 ? list->size * 2 : 16;
+
+        if ((list->buf = realloc(list->buf, list->size)) == NULL)
+        {
+            exit(1);
+        }
+    }
+
+    do
+    {
+        list->buf[list->len++] = (delta & 0x7f) | (delta > 0x7f ? 0x80 : 0);
+        delta >>= 7;
+    }
+    while (delta > 0);
+
+    gen->last[hash] = block + 1;
+}
+
+
+/**
+ * Adds a message to the search index.
+ * Posting lists are not shortened if messages are dropped from the
+ * store. Instead whole generations are dropped along with their messages.
+ * @param index Pointer to search index
+ * @param store Pointer to message store containing the message
+ * @param seq   Sequence number of message
+ * @param msg   Pointer to message
+ */
+void
+index_message(MSGINDEX_T* index, MSGSTORE_T* store, unsigned long long seq,
+              MSG_T* msg)
+{
+    TRIGRAMS_T* gen;
+
+    // all messages of older generation have been dropped
+    if (index->gens[0] != NULL && store->seq >= index->gens[1]->first)
+    {
+        free_trigrams(index->gens[0]);
+        index->gens[0] = NULL;
+    }
+
+    // store begins to drop messages of newer generation
+    if (index->gens[1] == NULL ||
+        (index->gens[0] == NULL && store->seq > index->gens[1]->first))
+    {
+        if ((gen = calloc(1, sizeof(*gen))) == NULL)
+        {
+            exit(1);
+        }
+
+        gen->first     = seq;
+        index->gens[0] = index->gens[1];
+        index->gens[1] = gen;
+    }
+
+    for (size_t i = 0; i + 3 <= msg->len; i++)
+    {
+        add_posting(index->gens[1], trigram_hash(msg->text + i),
+                    seq >> INDEX_BLOCK);
+    }
+}
+
+
+/**
+ * Intersects ascending block numbers with a posting list.
+ * @param list  Pointer to posting list
+ * @param first Sequence number of first indexed message
+ * @param cands Ascending block numbers, will contain the intersection
+ * @param count Number of block numbers
+ * @return Number of block numbers within intersection
+ */
+size_t
+intersect_postings(POSTINGS_T* list, unsigned long long first,
+                   unsigned long long* cands, size_t count)
+{
+    unsigned long long seq = first >> INDEX_BLOCK, delta;
+    size_t off = 0, i = 0, n = 0;
+    int shift;
+
+    while (off < list->len && i < count)
+    {
+        delta = 0;
+        shift = 0;
+
+        do
+        {
+            delta |= (unsigned long long) (list->buf[off] & 0x7f) << shift;
+            shift += 7;
+        }
+        while (list->buf[off++] & 0x80);
+
+        seq += delta;
+
+        while (i < count && cands[i] < seq)
+        {
+            i++;
+        }
+
+        if (i < count && cands[i] == seq)
+        {
+            cands[n++] = cands[i++];
+        }
+    }
+
+    return n;
+}
+
+
+/**
+ * Appends the message blocks of a generation of the search index
+ * containing all trigrams of the search query to the candidates.
+ * @param s   Pointer to search state
+ * @param gen Pointer to generation of search index
+ */
+void
+append_candidates(SEARCH_T* s, TRIGRAMS_T* gen)
+{
+    POSTINGS_T* shortest = NULL;
+    POSTINGS_T* list;
+    unsigned long long seq;
+    size_t off = 0, n = 0;
+    int shift;
+
+    // start with shortest posting list to keep intersections small
+    for (int i = 0; i + 3 <= s->len; i++)
+    {
+        list = &gen->lists[trigram_hash(s->query + i)];
+
+        if (shortest == NULL || list->len < shortest->len)
+        {
+            shortest = list;
+        }
+    }
+
+    if (s->size < s->count + shortest->len)
+    {
+        s->size = s->count + shortest->len;
+
+        if ((s->cands = realloc(s->cands, s->size * sizeof(*s->cands))) == NULL)
+        {
+            exit(1);
+        }
+    }
+
+    for (seq = gen->first >> INDEX_BLOCK; off < shortest->len; n++)
+    {
+        for (shift = 0; shortest->buf[off] & 0x80; shift += 7)
+        {
+            seq += (unsigned long long) (shortest->buf[off++] & 0x7f) << shift;
+        }
+
+        seq += (unsigned long long) shortest->buf[off++] << shift;
+        s->cands[s->count + n] = seq;
+    }
+
+    for (int i = 0; i + 3 <= s->len; i++)
+    {
+        list = &gen->lists[trigram_hash(s->query + i)];
+
+        if (list != shortest)
+        {
+            n = intersect_postings(list, gen->first, s->cands + s->count, n);
+        }
+    }
+
+    s->count += n;
+}
+
+
+/**
+ * Determines the messages that may match the search query.
+ * Candidates are the message blocks containing all trigrams of the query.
+ * If the query has been extended by one character, only the posting
+ * list of its last trigram has to be intersected with the candidates.
+ * Queries shorter than a trigram make every message a candidate.
+ * @param s     Pointer to search state
+ * @param store Pointer to message store
+ */
+void
+find_candidates(SEARCH_T* s, MSGSTORE_T* store)
+{
+    MSGINDEX_T* index = store->index;
+    TRIGRAMS_T* gen;
+    unsigned int hash;
+    size_t n = 0, m;
+
+    if (index != NULL && !s->all && s->cand_len >= 3 &&
+        s->cand_len == s->len - 1 && index->gens[1] != NULL &&
+        s->gen == index->gens[1]->first)
+    {
+        hash = trigram_hash(s->query + s->len - 3);
+
+        // candidates of a freed older generation have been dropped
+        if ((gen = index->gens[0]) != NULL)
+        {
+            n = intersect_postings(&gen->lists[hash], gen->first, s->cands,
+                                   s->split);
+        }
+
+        gen = index->gens[1];
+        m   = intersect_postings(&gen->lists[hash], gen->first,
+                                 s->cands + s->split, s->count - s->split);
+        memmove(s->cands + n, s->cands + s->split, m * sizeof(*s->cands));
+        s->split    = n;
+        s->count    = n + m;
+        s->cand_len = s->len;
+        return;
+    }
+
+    s->count    = 0;
+    s->split    = 0;
+    s->cand_len = s->len;
+    s->end      = store->seq + store->count;
+    s->all      = index == NULL || s->len < 3;
+
+    if (s->all)
+    {
+        return;
+    }
+
+    if (index->gens[0] != NULL)
+    {
+        append_candidates(s, index->gens[0]);
+        s->split = s->count;
+    }
+
+    if (index->gens[1] != NULL)
+    {
+        append_candidates(s, index->gens[1]);
+    }
+
+    s->gen = index->gens[1] != NULL ? index->gens[1]->first : 0;
+}
+
+
+/**
+ * Checks if the text of a message contains the search query.
+ * The comparison is case-insensitive.
+ * @param msg   Pointer to message
+ * @param query Search query
+ * @param len   Length of search query
+ * @return 1 if the message matches, 0 otherwise
+ */
+int
+match_message(MSG_T* msg, char* query, int len)
+{
+    int j;
+
+    for (size_t i = 0; i + len <= msg->len; i++)
+    {
+        for (j = 0; j < len && fold_char((unsigned char) msg->text[i + j]) ==
+             fold_char((unsigned char) query[j]); j++)
+        {
+        }
+
+        if (j == len)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Searches the newest message matching the query older than a message.
+ * Queries shorter than a trigram are only searched within the
+ * SEARCH_SCAN messages below the starting message. The previous match is
+ * kept if no older message matches.
+ * @param s     Pointer to search state
+ * @param store Pointer to message store
+ * @param end   Sequence number of message the search starts below
+ * @return 1 if a matching message has been found, 0 otherwise
+ */
+int
+search_next(SEARCH_T* s, MSGSTORE_T* store, unsigned long long end)
+{
+    size_t lo = 0, hi = s->count, mid;
+    unsigned long long seq, stop = store->seq, block;
+
+    if (end > store->seq + store->count)
+    {
+        end = store->seq + store->count;
+    }
+
+    // messages stored after the candidates have been determined
+    if (s->all)
+    {
+        stop = end > store->seq + SEARCH_SCAN ? end - SEARCH_SCAN : store->seq;
+    }
+    else if (s->end > store->seq)
+    {
+        stop = s->end;
+    }
+
+    for (seq = end; seq-- > stop;)
+    {
+        if (match_message(get_message(store, seq - store->seq), s->query, s->len))
+        {
+            s->match = seq;
+            return s->found = 1;
+        }
+    }
+
+    if (s->all || end <= store->seq)
+    {
+        return s->found = 0;
+    }
+
+    // first candidate block behind block of end - 1
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+
+        if (s->cands[mid] <= (end - 1) >> INDEX_BLOCK)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    // messages of candidate blocks are checked from newest to oldest,
+    // candidates of dropped messages are skipped
+    while (lo-- > 0)
+    {
+        block = s->cands[lo];
+        seq   = (block + 1) << INDEX_BLOCK;
+        seq   = seq < end ? seq : end;
+        stop  = block << INDEX_BLOCK;
+        stop  = stop > store->seq ? stop : store->seq;
+
+        if (seq <= store->seq)
+        {
+            break;
+        }
+
+        while (seq-- > stop)
+        {
+            if (match_message(get_message(store, seq - store->seq), s->query,
+                              s->len))
+            {
+                s->match = seq;
+                return s->found = 1;
+            }
+        }
+    }
+
+    return s->found = 0;
+}
+
+
+/**
+ * Updates the search after the query has been changed.
+ * The search continues at the current match, so that extending the
+ * query keeps a match that still matches.
+ * @param s     Pointer to search state
+ * @param store Pointer to message store
+ */
+void
+update_search(SEARCH_T* s, MSGSTORE_T* store)
+{
+    if (s->len == 0)
+    {
+        s->found = 0;
+        return;
+    }
+
+    find_candidates(s, store);
+    search_next(s, store, s->found ? s->match + 1 : store->seq + store->count);
+}
+
+
+/**
+ * Scrolls a message view to show a message in its top row.
+ * @param view Pointer to message view
+ * @param store Pointer to message store
+ * @param win  Pointer to chat window showing the view
+ * @param seq  Sequence number of message
+ */
+void
+show_message(MSGVIEW_T* view, MSGSTORE_T* store, DWINDOW_T* win,
+             unsigned long long seq)
+{
+    view->follow = 0;
+    view->seq    = seq;
+    view->row    = 0;
+    // follows the newest messages again, if the message is on the last page
+    scroll_view(view, store, win, 0);
+}
+
+
+/**
+ * Frees all contacts of a roster.
+ * @param r Pointer to roster
+ */
+void
+free_roster(ROSTER_T* r)
+{
+    for (size_t i = 0; i < r->count; i++)
+    {
+        free(r->sorted[i]->key);
+        free(r->sorted[i]);
+    }
+
+    free(r->buckets);
+    free(r->sorted);
+    memset(r, 0, sizeof(*r));
+}
+
+
+/**
+ * Returns the hash value of the key of a contact (FNV-1a).
+ * @param key Onion ID or nickname
+ * @return Hash value
+ */
+unsigned int
+contact_hash(const char* key)
+{
+    uint32_t h = 2166136261u;
+
+    while (*key != '\0')
+    {
+        h = (h ^ (unsigned char) *key++) * 16777619u;
+    }
+
+    return h;
+}
+
+
+/**
+ * Looks up a contact of the roster.
+ * @param r    Pointer to roster
+ * @param key  Onion ID or nickname identifying the contact
+ * @param hash Hash value of key
+ * @return Pointer to contact, NULL if not found
+ */
+CONTACT_T*
+find_contact(ROSTER_T* r, char* key, unsigned int hash)
+{
+    CONTACT_T* c;
+
+    if (r->nbuckets == 0)
+    {
+        return NULL;
+    }
+
+    for (c = r->buckets[hash & (r->nbuckets - 1)]; c != NULL; c = c->next)
+    {
+        if (c->hash == hash && strcmp(c->key, key) == 0)
+        {
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Compares the order of two contacts within the sorted view.
+ * Contacts are sorted case-insensitively by nickname, contacts with the
+ * same nickname by their key.
+ * @param a Pointer to first contact
+ * @param b Pointer to second contact
+ * @return <0, 0 or >0 if a is sorted before, at or after b
+ */
+int
+cmp_contacts(CONTACT_T* a, CONTACT_T* b)
+{
+    int cmp;
+
+    if ((cmp = strcasecmp(a->nickname, b->nickname)) != 0 ||
+        (cmp = strcmp(a->nickname, b->nickname)) != 0)
+    {
+        return cmp;
+    }
+
+    return strcmp(a->key, b->key);
+}
+
+
+/**
+ * Returns the index of a contact within the sorted view.
+ * @param r Pointer to roster
+ * @param c Pointer to contact
+ * @return Index of contact, or index it has to be inserted at
+ */
+size_t
+contact_rank(ROSTER_T* r, CONTACT_T* c)
+{
+    size_t lo = 0, hi = r->count, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+
+        if (cmp_contacts(r->sorted[mid], c) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+/**
+ * Doubles the number of hash buckets of a roster.
+ * @param r Pointer to roster
+ */
+void
+grow_roster(ROSTER_T* r)
+{
+    size_t n = r->nbuckets > 0 ? r->nbuckets * 2 : ROSTER_BUCKETS;
+    CONTACT_T** buckets;
+    CONTACT_T* c;
+    CONTACT_T* next;
+
+    if ((buckets = calloc(n, sizeof(*buckets))) == NULL)
+    {
+        exit(1);
+    }
+
+    for (size_t i = 0; i < r->nbuckets; i++)
+    {
+        for (c = r->buckets[i]; c != NULL; c = next)
+        {
+            next = c->next;
+            c->next = buckets[c->hash & (n - 1)];
+            buckets[c->hash & (n - 1)] = c;
+        }
+    }
+
+    free(r->buckets);
+    r->buckets  = buckets;
+    r->nbuckets = n;
+}
+
+
+/**
+ * Inserts a contact into the sorted view.
+ * All rows from the inserted one on have to be redrawn.
+ * @param r Pointer to roster
+ * @param c Pointer to contact
+ */
+void
+sort_contact(ROSTER_T* r, CONTACT_T* c)
+{
+    size_t i = contact_rank(r, c);
+
+    if (r->count == r->size)
+    {
+        r->size = r->size > 0 ? r->size * 2 : ROSTER_BUCKETS;
+
+        if ((r->sorted = realloc(r->sorted, r->size * sizeof(*r->sorted))) == NULL)
+        {
+            exit(1);
+        }
+    }
+
+    memmove(r->sorted + i + 1, r->sorted + i, (r->count - i) * sizeof(*r->sorted));
+    r->sorted[i] = c;
+    r->count++;
+    r->dirty_lo = i < r->dirty_lo ? i : r->dirty_lo;
+    r->dirty_hi = r->count > r->dirty_hi ? r->count : r->dirty_hi;
+}
+
+
+/**
+ * Removes a contact from the sorted view.
+ * All rows from the removed one on have to be redrawn.
+ * @param r Pointer to roster
+ * @param c Pointer to contact
+ */
+void
+unsort_contact(ROSTER_T* r, CONTACT_T* c)
+{
+    size_t i = contact_rank(r, c);
+
+    r->count--;
+    memmove(r->sorted + i, r->sorted + i + 1, (r->count - i) * sizeof(*r->sorted));
+    r->dirty_lo = i < r->dirty_lo ? i : r->dirty_lo;
+    r->dirty_hi = r->count + 1 > r->dirty_hi ? r->count + 1 : r->dirty_hi;
+}
+
+
+/**
+ * Adds a contact to the roster.
+ * If the contact is already known, its nickname is updated.
+ * @param r        Pointer to roster
+ * @param nickname Nickname of contact
+ * @param onion    Onion ID of contact, empty if unknown
+ */
+void
+join_contact(ROSTER_T* r, char* nickname, char* onion)
+{
+    char* key = *onion != '\0' ? onion : nickname;
+    unsigned int hash = contact_hash(key);
+    size_t key_len = strlen(key), nick_len = strlen(nickname);
+    CONTACT_T* c;
+
+    if ((c = find_contact(r, key, hash)) != NULL)
+    {
+        if (strcmp(c->nickname, nickname) == 0)
+        {
+            return;
+        }
+
+        // renamed contact moves within the sorted view
+        unsort_contact(r, c);
+    }
+    else
+    {
+        if (r->count >= r->nbuckets)
+        {
+            grow_roster(r);
+        }
+
+        if ((c = malloc(sizeof(*c))) == NULL)
+        {
+            exit(1);
+        }
+
+        c->key  = NULL;
+        c->hash = hash;
+        c->next = r->buckets[hash & (r->nbuckets - 1)];
+        r->buckets[hash & (r->nbuckets - 1)] = c;
+    }
+
+    // key and nickname share one allocation: <key>\0<nickname>\0
+    if ((c->key = realloc(c->key, key_len + nick_len + 2)) == NULL)
+    {
+        exit(1);
+    }
+
+    memcpy(c->key, key, key_len + 1);
+    c->nickname = c->key + key_len + 1;
+    memcpy(c->nickname, nickname, nick_len + 1);
+    sort_contact(r, c);
+}
+
+
+/**
+ * Removes a contact from the roster.
+ * @param r        Pointer to roster
+ * @param nickname Nickname of contact
+ * @param onion    Onion ID of contact, empty if unknown
+ */
+void
+leave_contact(ROSTER_T* r, char* nickname, char* onion)
+{
+    char* key = *onion != '\0' ? onion : nickname;
+    unsigned int hash = contact_hash(key);
+    CONTACT_T** link;
+    CONTACT_T* c;
+
+    if (r->nbuckets == 0)
+    {
+        return;
+    }
+
+    for (link = &r->buckets[hash & (r->nbuckets - 1)]; (c = *link) != NULL;
+         link = &c->next)
+    {
+        if (c->hash == hash && strcmp(c->key, key) == 0)
+        {
+            *link = c->next;
+            unsort_contact(r, c);
+            free(c->key);
+            free(c);
+            return;
+        }
+    }
+}
+
+
+/**
+ * Marks all rows of the roster window to be redrawn.
+ * @param r Pointer to roster
+ */
+void
+touch_roster(ROSTER_T* r)
+{
+    r->dirty_lo = 0;
+    r->dirty_hi = SIZE_MAX;
+}
+
+
+/**
+ * Scrolls the roster window up/downwards.
+ * @param r   Pointer to roster
+ * @param win Pointer to chat window showing the roster
+ * @param n   Rows to scroll, positive values scroll upwards
+ */
+void
+scroll_roster(ROSTER_T* r, DWINDOW_T* win, int n)
+{
+    size_t max = r->count > (size_t) win->h ? r->count - win->h : 0;
+    long long top = (long long) r->top - n;
+
+    top = top < 0 ? 0 : top;
+    top = (size_t) top > max ? (long long) max : top;
+
+    if ((size_t) top != r->top)
+    {
+        r->top = top;
+        touch_roster(r);
+        mark_dirty(win);
+    }
+}
+
+
+/**
+ * Redraws the changed rows of the roster window.
+ * @param r   Pointer to roster
+ * @param win Pointer to chat window showing the roster
+ */
+void
+render_roster(ROSTER_T* r, DWINDOW_T* win)
+{
+    size_t max = r->count > (size_t) win->h ? r->count - win->h : 0;
+    size_t lo, hi;
+
+    // contacts below the window have left
+    if (r->top > max)
+    {
+        r->top = max;
+        touch_roster(r);
+    }
+
+    lo = r->dirty_lo > r->top ? r->dirty_lo : r->top;
+    hi = r->dirty_hi < r->top + win->h ? r->dirty_hi : r->top + win->h;
+
+    for (size_t i = lo; i < hi; i++)
+    {
+        wmove(win->win, i - r->top, 0);
+        wclrtoeol(win->win);
+
+        if (i < r->count)
+        {
+            add_text(win->win, r->sorted[i]->nickname,
+                     strlen(r->sorted[i]->nickname), win->w);
+        }
+    }
+
+    r->dirty_lo = SIZE_MAX;
+    r->dirty_hi = 0;
+}
+
+
+/**
+ * Returns the histogram bucket of a value.
+ * @param value Value to determine bucket of, negative values count as 0
+ * @return Index of bucket
+ */
+int
+hist_index(long long value)
+{
+    int shift;
+
+    if (value < (1 << HIST_SUB_BITS))
+    {
+        return value < 0 ? 0 : value;
+    }
+
+    if (value >= 1LL << HIST_MAX_BITS)
+    {
+        value = (1LL << HIST_MAX_BITS) - 1;
+    }
+
+    // shift value, so that its highest bit is bit HIST_SUB_BITS-1
+    shift = 63 - __builtin_clzll(value) - (HIST_SUB_BITS - 1);
+    return (shift << (HIST_SUB_BITS - 1)) + (value >> shift);
+}
+
+
+/**
+ * Returns the highest value counted within a histogram bucket.
+ * @param index Index of bucket
+ * @return Highest value of bucket
+ */
+long long
+hist_value(int index)
+{
+    int shift = (index >> (HIST_SUB_BITS - 1)) - 1;
+
+    if (index < (1 << HIST_SUB_BITS))
+    {
+        return index;
+    }
+
+    return ((long long) (index - (shift << (HIST_SUB_BITS - 1)) + 1) << shift) - 1;
+}
+
+
+/**
+ * Records a latency within a histogram.
+ * @param h  Pointer to histogram
+ * @param ns Latency in ns
+ * @param n  Number of times the latency is recorded
+ */
+void
+record_latency(HISTOGRAM_T* h, long long ns, unsigned long n)
+{
+    h->counts[hist_index(ns)] += n;
+    h->total += n;
+
+    if (ns > h->max)
+    {
+        h->max = ns;
+    }
+}
+
+
+/**
+ * Returns a percentile of the values recorded within a histogram.
+ * @param h Pointer to histogram
+ * @param p Percentile between 0 and 1
+ * @return Highest value of the bucket containing the percentile,
+ *         0 if nothing has been recorded
+ */
+long long
+hist_percentile(HISTOGRAM_T* h, double p)
+{
+    unsigned long long rank = p * h->total + 0.5, count = 0;
+
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    for (int i = 0; i < HIST_BUCKETS && h->total > 0; i++)
+    {
+        if ((count += h->counts[i]) >= rank)
+        {
+            // bucket may reach beyond maximum value
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Formats a latency with an appropriate unit.
+ * @param ns   Latency in ns
+ * @param buf  Will contain the formatted latency
+ * @param size Size of buffer
+ */
+void
+format_latency(long long ns, char* buf, size_t size)
+{
+    if (ns < 1000)
+    {
+        snprintf(buf, size, "%lldns", ns);
+    }
+    else if (ns < 1000000)
+    {
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    }
+    else if (ns < 1000000000)
+    {
+        snprintf(buf, size, "%.1fms", ns / 1e6);
+    }
+    else
+    {
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+    }
+}
+
+
+/**
+ * Formats count, percentiles and maximum of a histogram as table row.
+ * @param h    Pointer to histogram
+ * @param name Name of histogram
+ * @param buf  Will contain the formatted row
+ * @param size Size of buffer
+ */
+void
+format_hist(HISTOGRAM_T* h, char* name, char* buf, size_t size)
+{
+    char p50[16], p99[16], p999[16], max[16];
+    format_latency(hist_percentile(h, 0.5), p50, sizeof(p50));
+    format_latency(hist_percentile(h, 0.99), p99, sizeof(p99));
+    format_latency(hist_percentile(h, 0.999), p999, sizeof(p999));
+    format_latency(h->max, max, sizeof(max));
+    snprintf(buf, size, "%-13s%9llu%9s%9s%9s%9s", name, h->total, p50, p99,
+             p999, max);
+}
+
+
+/**
+ * Writes the latency statistics to a file.
+ * @param stats Pointer to latency statistics
+ * @param f     File to write to
+ */
+void
+write_stats(STATS_T* stats, FILE* f)
+{
+    char row[STATS_WIDTH];
+    fprintf(f, "%-13s%9s%9s%9s%9s%9s\n", "latency", "count", "p50", "p99",
+            "p999", "max");
+    format_hist(&stats->recv_enq, "recv->enq", row, sizeof(row));
+    fprintf(f, "%s\n", row);
+    format_hist(&stats->enq_render, "enq->render", row, sizeof(row));
+    fprintf(f, "%s\n", row);
+    format_hist(&stats->render_flush, "render->flush", row, sizeof(row));
+    fprintf(f, "%s\n", row);
+}
+
+
+/**
+ * Stages the statistics overlay on top of the message window.
+ * @param stats Pointer to latency statistics
+ */
+void
+render_stats(STATS_T* stats)
+{
+    char row[STATS_WIDTH];
+    werase(_win_stats);
+    box(_win_stats, 0, 0);
+    mvwprintw(_win_stats, 1, 1, "%-13s%9s%9s%9s%9s%9s", "latency", "count",
+              "p50", "p99", "p999", "max");
+    format_hist(&stats->recv_enq, "recv->enq", row, sizeof(row));
+    mvwaddstr(_win_stats, 2, 1, row);
+    format_hist(&stats->enq_render, "enq->render", row, sizeof(row));
+    mvwaddstr(_win_stats, 3, 1, row);
+    format_hist(&stats->render_flush, "render->flush", row, sizeof(row));
+    mvwaddstr(_win_stats, 4, 1, row);
+    // overlay may have been overwritten by the message window
+    touchwin(_win_stats);
+    wnoutrefresh(_win_stats);
+}
+
+
+/**
+ * Returns the path of the history file.
+ * Messages are only kept on disk if the user asks for it, so the history
+ * is disabled unless ENV_HISTORY names a file.
+ * @return Allocated path, NULL if the history is disabled
+ */
+char*
+history_path()
+{
+    char* env = getenv(ENV_HISTORY);
+
+    if (env == NULL || *env == '\0')
+    {
+        return NULL;
+    }
+
+    if ((env = strdup(env)) == NULL)
+    {
+        exit(1);
+    }
+
+    return env;
+}
+
+
+/**
+ * Opens the history file and starts its writer thread.
+ * The history file is mapped into memory until load_history() has been
+ * called. A torn record at the end of the file, left by a crash, is
+ * truncated.
+ * @param h    Pointer to history structure
+ * @param path Path of history file, created if not existing
+ * @return 0 on success, -1 otherwise
+ */
+int
+open_history(HISTLOG_T* h, char* path)
+{
+    struct stat st;
+    sigset_t sigmask, oldmask;
+
+    if ((h->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+                      0600)) == -1)
+    {
+        return -1;
+    }
+
+    if (fstat(h->fd, &st) == -1)
+    {
+        close(h->fd);
+        h->fd = -1;
+        return -1;
+    }
+
+    // new history file starts with signature only
+    if (st.st_size == 0)
+    {
+        if (write(h->fd, HIST_SIGNATURE, HIST_SIG_LEN) != HIST_SIG_LEN)
+        {
+            close(h->fd);
+            h->fd = -1;
+            return -1;
+        }
+
+        st.st_size = HIST_SIG_LEN;
+    }
+
+    h->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, h->fd, 0);
+
+    if (h->map == MAP_FAILED || st.st_size < HIST_SIG_LEN ||
+        memcmp(h->map, HIST_SIGNATURE, HIST_SIG_LEN) != 0)
+    {
+        if (h->map != MAP_FAILED)
+        {
+            munmap(h->map, st.st_size);
+        }
+
+        h->map = NULL;
+        close(h->fd);
+        h->fd = -1;
+        errno = EINVAL;
+        return -1;
+    }
+
+    h->map_size = st.st_size;
+    h->end      = history_end(h->map, st.st_size);
+
+    if (h->end < st.st_size && ftruncate(h->fd, h->end) == -1)
+    {
+        munmap(h->map, h->map_size);
+        h->map = NULL;
+        close(h->fd);
+        h->fd = -1;
+        return -1;
+    }
+
+    if ((h->path = strdup(path)) == NULL)
+    {
+        exit(1);
+    }
+
+    h->file_size = h->end;
+    h->buf       = NULL;
+    h->len       = 0;
+    h->size      = 0;
+    h->dropped   = 0;
+    h->stop      = 0;
+    pthread_mutex_init(&h->lock, NULL);
+    pthread_cond_init(&h->cond, NULL);
+    // signals are handled by the event loop only
+    sigfillset(&sigmask);
+    pthread_sigmask(SIG_SETMASK, &sigmask, &oldmask);
+
+    if (pthread_create(&h->thread, NULL, th_write_history, h) != 0)
+    {
+        exit(1);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+    return 0;
+}
+
+
+/**
+ * Writes all pending records and closes the history file.
+ * @param h Pointer to history structure
+ */
+void
+close_history(HISTLOG_T* h)
+{
+    if (h->fd == -1)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&h->lock);
+    h->stop = 1;
+    pthread_cond_signal(&h->cond);
+    pthread_mutex_unlock(&h->lock);
+    pthread_join(h->thread, NULL);
+
+    if (h->map != NULL)
+    {
+        munmap(h->map, h->map_size);
+        h->map = NULL;
+    }
+
+    pthread_mutex_destroy(&h->lock);
+    pthread_cond_destroy(&h->cond);
+    close(h->fd);
+    free(h->buf);
+    free(h->path);
+    h->fd = -1;
+}
+
+
+/**
+ * Rotates the history file.
+ * The history file is renamed by appending HIST_ROTATED, which replaces
+ * a previously rotated file, and a new history file is started. The file
+ * descriptor number of the history is kept. Must only be called by the
+ * writer thread.
+ * @param h Pointer to history structure
+ * @return 0 on success, -1 otherwise
+ */
+int
+rotate_history(HISTLOG_T* h)
+{
+    char* rotated;
+    int fd;
+
+    if ((rotated = malloc(strlen(h->path) + strlen(HIST_ROTATED) + 1)) == NULL)
+    {
+        exit(1);
+    }
+
+    sprintf(rotated, "%s%s", h->path, HIST_ROTATED);
+
+    if (rename(h->path, rotated) == -1)
+    {
+        free(rotated);
+        return -1;
+    }
+
+    free(rotated);
+
+    if ((fd = open(h->path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                   0600)) == -1)
+    {
+        return -1;
+    }
+
+    if (write(fd, HIST_SIGNATURE, HIST_SIG_LEN) != HIST_SIG_LEN ||
+        dup3(fd, h->fd, O_CLOEXEC) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    h->file_size = HIST_SIG_LEN;
+    return 0;
+}
+
+
+/**
+ * Checks if a valid record starts at an offset of the history file.
+ * @param map Mapped history file
+ * @param end End of valid data within mapping
+ * @param off Offset of record
+ * @return Size of record, 0 if the record is invalid
+ */
+int
+valid_record(char* map, size_t end, size_t off)
+{
+    HISTREC_T* rec = (HISTREC_T*) (map + off);
+    HISTTRL_T* trl;
+
+    if (off % 8 != 0 || off + sizeof(*rec) + sizeof(*trl) > end ||
+        rec->magic != HIST_MAGIC || rec->size % 8 != 0 ||
+        rec->size > end - off ||
+        sizeof(*rec) + rec->nick_len + rec->text_len + sizeof(*trl) > rec->size)
+    {
+        return 0;
+    }
+
+    trl = (HISTTRL_T*) (map + off + rec->size - sizeof(*trl));
+
+    if (trl->magic != HIST_MAGIC || trl->size != rec->size)
+    {
+        return 0;
+    }
+
+    return rec->size;
+}
+
+
+/**
+ * Determines the end of the last valid record of the history file.
+ * Only the last record is checked, unless it is torn. Then the whole
+ * file has to be scanned.
+ * @param map  Mapped history file
+ * @param size Size of history file
+ * @return Offset behind the last valid record
+ */
+size_t
+history_end(char* map, size_t size)
+{
+    HISTTRL_T* trl;
+    size_t off = HIST_SIG_LEN;
+    int rec_size;
+
+    if (size >= HIST_SIG_LEN + sizeof(*trl) && size % 8 == 0)
+    {
+        trl = (HISTTRL_T*) (map + size - sizeof(*trl));
+
+        if (trl->size <= size - HIST_SIG_LEN &&
+            valid_record(map, size, size - trl->size) != 0)
+        {
+            return size;
+        }
+    }
+
+    while ((rec_size = valid_record(map, size, off)) != 0)
+    {
+        off += rec_size;
+    }
+
+    return off;
+}
+
+
+/**
+ * Moves the newest messages of the history file into the message store.
+ * The history file is read backwards, so that its size does not matter.
+ * Afterwards the history file is unmapped.
+ * @param h     Pointer to history structure
+ * @param store Pointer to message store
+ * @param w     Width of message window
+ * @param rows  Number of rows of messages to load
+ * @return Number of loaded messages
+ */
+int
+load_history(HISTLOG_T* h, MSGSTORE_T* store, int w, int rows)
+{
+    HISTREC_T* rec;
+    HISTTRL_T* trl;
+    MSG_T msg;
+    RUN_T* run;
+    size_t* offs = NULL;
+    size_t end = h->end, size = 0;
+    char nickname[UINT16_MAX + 1];
+    int n = 0;
+
+    if (h->map == NULL)
+    {
+        return 0;
+    }
+
+    // collect records from newest to oldest until enough rows are filled
+    while (rows > 0 && end > HIST_SIG_LEN)
+    {
+        trl = (HISTTRL_T*) (h->map + end - sizeof(*trl));
+
+        if (trl->size > end - HIST_SIG_LEN ||
+            valid_record(h->map, end, end - trl->size) == 0)
+        {
+            break;
+        }
+
+        end -= trl->size;
+
+        if (n == size)
+        {
+            size = size > 0 ? size * 2 : 64;
+
+            if ((offs = realloc(offs, size * sizeof(*offs))) == NULL)
+            {
+                exit(1);
+            }
+        }
+
+        offs[n++] = end;
+        rec = (HISTREC_T*) (h->map + end);
+        memcpy(nickname, rec + 1, rec->nick_len);
+        nickname[rec->nick_len] = '\0';
+        msg.nickname = nickname;
+        msg.text     = (char*) (rec + 1) + rec->nick_len;
+        msg.len      = rec->text_len;
+        msg.time     = rec->time;
+        msg.type     = rec->type;
+        run   = build_run(&msg);
+        rows -= draw_message(NULL, run, w, 0, 0, 0);
+        free(run);
+    }
+
+    // store records from oldest to newest
+    for (int i = n - 1; i >= 0; i--)
+    {
+        rec = (HISTREC_T*) (h->map + offs[i]);
+        memcpy(nickname, rec + 1, rec->nick_len);
+        nickname[rec->nick_len] = '\0';
+        store_message(store, rec->time, rec->type, nickname,
+                      (char*) (rec + 1) + rec->nick_len, rec->text_len);
+    }
+
+    free(offs);
+    munmap(h->map, h->map_size);
+    h->map = NULL;
+    return n;
+}
+
+
+/**
+ * Appends a message to the records pending for the history file.
+ * The record is written by the writer thread after commit_history() has
+ * been called. If the writer thread falls behind, the record is dropped.
+ * @param h   Pointer to history structure
+ * @param msg Pointer to message
+ */
+void
+log_message(HISTLOG_T* h, MSG_T* msg)
+{
+    HISTREC_T* rec;
+    HISTTRL_T* trl;
+    size_t nick_len = strlen(msg->nickname);
+    size_t size;
+
+    if (h->fd == -1)
+    {
+        return;
+    }
+
+    nick_len = nick_len > UINT16_MAX ? UINT16_MAX : nick_len;
+    size = (sizeof(*rec) + nick_len + msg->len + 7) / 8 * 8 + sizeof(*trl);
+    pthread_mutex_lock(&h->lock);
+
+    if (h->len + size > HIST_BUF_MAX)
+    {
+        h->dropped++;
+        pthread_mutex_unlock(&h->lock);
+        return;
+    }
+
+    if (h->len + size > h->size)
+    {
+        h->size = h->size > 0 ? h->size * 2 : LINEBUF_CHUNK;
+
+        while (h->len + size > h->size)
+        {
+            h->size *= 2;
+        }
+
+        if ((h->buf = realloc(h->buf, h->size)) == NULL)
+        {
+            exit(1);
+        }
+    }
+
+    // header, nickname, text, padding and trailer
+    rec = (HISTREC_T*) (h->buf + h->len);
+    rec->size     = size;
+    rec->type     = msg->type;
+    rec->nick_len = nick_len;
+    rec->time     = msg->time;
+    rec->text_len = msg->len;
+    rec->magic    = HIST_MAGIC;
+    memcpy(rec + 1, msg->nickname, nick_len);
+    memcpy((char*) (rec + 1) + nick_len, msg->text, msg->len);
+    memset((char*) (rec + 1) + nick_len + msg->len, 0,
+           size - sizeof(*rec) - nick_len - msg->len - sizeof(*trl));
+    trl = (HISTTRL_T*) (h->buf + h->len + size - sizeof(*trl));
+    trl->size  = size;
+    trl->magic = HIST_MAGIC;
+    h->len += size;
+    pthread_mutex_unlock(&h->lock);
+}
+
+
+/**
+ * Wakes up the writer thread to write all pending records.
+ * @param h Pointer to history structure
+ */
+void
+commit_history(HISTLOG_T* h)
+{
+    if (h->fd == -1)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&h->lock);
+    pthread_cond_signal(&h->cond);
+    pthread_mutex_unlock(&h->lock);
+}
+
+
+/**
+ * Thread function that writes pending records to the history file.
+ * Buffers are swapped with the event loop, so that records can be
+ * collected while the previous ones are written. The history file is
+ * rotated before it exceeds HIST_MAX_SIZE. If records could not be
+ * written, the file is truncated to the last complete record and the
+ * records are counted as dropped. If this fails as well, the history is
+ * not written anymore.
+ * @param ptr Pointer to history structure
+ * @return NULL
+ */
+void*
+th_write_history(void* ptr)
+{
+    HISTLOG_T* h = ptr;
+    char* buf = NULL;
+    char* tmp;
+    size_t size = 0, len, off;
+    unsigned long dropped;
+    int failed = 0;
+    ssize_t ret;
+    pthread_mutex_lock(&h->lock);
+
+    while (1)
+    {
+        while (h->len == 0 && !h->stop)
+        {
+            pthread_cond_wait(&h->cond, &h->lock);
+        }
+
+        // stop after all pending records have been written
+        if (h->len == 0)
+        {
+            break;
+        }
+
+        tmp     = h->buf;
+        h->buf  = buf;
+        buf     = tmp;
+        len     = h->len;
+        h->len  = 0;
+        off     = h->size;
+        h->size = size;
+        size    = off;
+        pthread_mutex_unlock(&h->lock);
+
+        if (!failed && h->file_size > HIST_SIG_LEN &&
+            h->file_size + len > HIST_MAX_SIZE)
+        {
+            failed = rotate_history(h) == -1;
+        }
+
+        // records are appended as a whole, a failed write is not retried
+        for (off = 0; !failed && off < len; off += ret)
+        {
+            if ((ret = write(h->fd, buf + off, len - off)) == -1)
+            {
+                if (errno == EINTR)
+                {
+                    ret = 0;
+                    continue;
+                }
+
+                break;
+            }
+        }
+
+        dropped = 0;
+
+        if (!failed && off == len)
+        {
+            h->file_size += len;
+        }
+        else
+        {
+            // a torn record would hide all records appended after it
+            if (!failed && ftruncate(h->fd, h->file_size) == -1)
+            {
+                failed = 1;
+            }
+
+            for (off = 0; off < len; off += ((HISTREC_T*) (buf + off))->size)
+            {
+                dropped++;
+            }
+        }
+
+        pthread_mutex_lock(&h->lock);
+        h->dropped += dropped;
+    }
+
+    pthread_mutex_unlock(&h->lock);
+    free(buf);
+    return NULL;
+}
+
+
+/**
+ * Starts capturing the data received on the UI unix sockets.
+ * An existing trace file is overwritten.
+ * @param t    Pointer to trace structure
+ * @param path Path of trace file
+ * @return 0 on success, -1 otherwise
+ */
+int
+open_trace(TRACE_T* t, char* path)
+{
+    if ((t->f = fopen(path, "w")) == NULL)
+    {
+        return -1;
+    }
+
+    // records are small, so they are written in large blocks
+    setvbuf(t->f, NULL, _IOFBF, TRACE_BUF);
+
+    if (fwrite(TRACE_SIGNATURE, TRACE_SIG_LEN, 1, t->f) != 1)
+    {
+        fclose(t->f);
+        t->f = NULL;
+        return -1;
+    }
+
+    t->start = now_ns();
+    return 0;
+}
+
+
+/**
+ * Appends data received on a UI unix socket to the trace.
+ * Nothing is done if no capture has been started.
+ * @param t      Pointer to trace structure
+ * @param source Source of data: enum tracesources
+ * @param data   Data as received
+ * @param len    Length of data
+ */
+void
+trace_data(TRACE_T* t, int source, char* data, size_t len)
+{
+    TRACEREC_T rec;
+
+    if (t->f == NULL)
+    {
+        return;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.time   = now_ns() - t->start;
+    rec.len    = len;
+    rec.source = source;
+    fwrite(&rec, sizeof(rec), 1, t->f);
+
+    if (len > 0)
+    {
+        fwrite(data, 1, len, t->f);
+    }
+}
+
+
+/**
+ * Stops capturing and closes the trace file.
+ * @param t Pointer to trace structure
+ */
+void
+close_trace(TRACE_T* t)
+{
+    if (t->f != NULL)
+    {
+        fclose(t->f);
+        t->f = NULL;
+    }
+}
+
+
+/**
+ * Appends data read from the input or logging unix socket to the trace.
+ * Called by the line readers of the sockets for every chunk read.
+ * @param fd   File descriptor the data has been read from
+ * @param data Data as received
+ * @param len  Length of data
+ */
+void
+trace_sock(int fd, char* data, size_t len)
+{
+    trace_data(&_trace, fd == _ipc.log_sock ? TRACE_LOG : TRACE_INP, data, len);
+}
+
+
+/**
+ *  Determines the framing of the input unix socket from its first bytes.
+ *  FRAME_MAGIC is consumed if the core has accepted the framed mode.
+ *  Text lines never start with \\0, so at most FRAME_MAGIC_LEN bytes
+ *  have to be awaited.
+ *  @param lb Pointer to line reader structure of the input socket
+ *  @param fd File descriptor of the input socket
+ *  @return framing of the socket (enum framing), 0 on EOF, -1 on error
+ */
+int
+detect_framing(LINEBUF_T* lb, int fd)
+{
+    size_t n;
+    int ret;
+
+    // read until the buffered bytes are no prefix of FRAME_MAGIC anymore
+    while ((n = lb->end - lb->start) < FRAME_MAGIC_LEN &&
+           (n == 0 || memcmp(lb->buf + lb->start, FRAME_MAGIC, n) == 0))
+    {
+        if ((ret = fill_linebuf(lb, fd, 0)) <= 0)
+        {
+            return ret;
+        }
+    }
+
+    if (n < FRAME_MAGIC_LEN ||
+        memcmp(lb->buf + lb->start, FRAME_MAGIC, FRAME_MAGIC_LEN) != 0)
+    {
+        return FRAMING_TEXT;
+    }
+
+    lb->start += FRAME_MAGIC_LEN;
+    return FRAMING_BINARY;
+}
+
+
+/**
+ *  Reads a binary frame from a file descriptor.
+ *  The frame is handed out directly from the buffer of the line reader
+ *  without scanning or copying its nickname and body.
+ *  @param lb Pointer to line reader structure of the file descriptor
+ *  @param fd File descriptor to read from
+ *  @param f  Will contain the frame. Nickname and body remain valid
+ *            until the next call of this function.
+ *  @return length of frame, 0 on EOF, -1 on error (errno EPROTO if the
+ *          frame is malformed)
+ */
+int
+read_frame(LINEBUF_T* lb, int fd, FRAME_T* f)
+{
+    FRAMEHDR_T hdr;
+    size_t len;
+    char* p;
+    int ret;
+
+    while (lb->end - lb->start < sizeof(hdr))
+    {
+        if ((ret = fill_linebuf(lb, fd, 0)) <= 0)
+        {
+            return ret;
+        }
+    }
+
+    // header may not be aligned within the buffer
+    memcpy(&hdr, lb->buf + lb->start, sizeof(hdr));
+
+    if ((size_t) hdr.nick_len + hdr.len + 2 > FRAME_MAX)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    len = sizeof(hdr) + hdr.nick_len + hdr.len + 2;
+
+    while (lb->end - lb->start < len)
+    {
+        if ((ret = fill_linebuf(lb, fd, len)) <= 0)
+        {
+            return ret;
+        }
+    }
+
+    p = lb->buf + lb->start + sizeof(hdr);
+
+    if (p[hdr.nick_len] != '\0' || p[hdr.nick_len + 1 + hdr.len] != '\0')
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    f->type     = hdr.type;
+    f->nickname = p;
+    f->body     = p + hdr.nick_len + 1;
+    f->len      = hdr.len;
+    f->time     = hdr.time;
+    lb->start  += len;
+    return len;
+}
+
+
+/**
+ *  Parses a text line of the input unix socket into a frame.
+ *  Lines have the format nickname;message, the first line with an empty
+ *  message defines the nickname of the user. Nicknames are chosen by the
+ *  peers, so no nickname gives a line any other meaning: roster updates
+ *  are only accepted as FRAME_JOIN and FRAME_LEAVE frames.
+ *  @param line Line without \\n, will be modified
+ *  @param f    Will contain the frame pointing into the line
+ *  @return 0 on success, -1 if the line is malformed
+ */
+int
+parse_line(char* line, FRAME_T* f)
+{
+    char* save_ptr; // used for strtok
+
+    // split line: line format -> nickname;message
+    if ((f->nickname = strtok_r(line, ";", &save_ptr)) == NULL)
+    {
+        return -1;
+    }
+
+    f->body = save_ptr;
+    f->len  = strlen(f->body);
+    f->time = 0;
+    f->type = FRAME_MESSAGE;
+
+    // first message contains a message form the dchat core which
+    // defines what nickname should be used
+    if (f->len == 0 && !_ipc.has_nick)
+    {
+        f->type = FRAME_NICKNAME;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Connects to a unix domain local socket.
+ *  @param local_path Local socket path to connect to
+ *  @return File descriptor or -1 on error
+ */
+int
+unix_connect(char* local_path)
+{
+    int fd;
+    struct sockaddr_un unix_addr;
+
+    // paths may be set by environment variables
+    if (strlen(local_path) >= sizeof(unix_addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(&unix_addr, 0, sizeof(unix_addr));
+    unix_addr.sun_family = PF_LOCAL;
+    strncpy(unix_addr.sun_path, local_path, sizeof(unix_addr.sun_path) - 1);
+
+    // unix sockets connect at once or fail with EAGAIN if the backlog
+    // of the peer is full, so connecting never blocks
+    if ((fd = socket(PF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1)
+    {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*) &unix_addr, sizeof(unix_addr)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/**
+ *  Initializes the global inter process communication structure, used for this GUI.
+ *  This function also creates the epoll instance of the event loop and
+ *  registers the terminal for keyboard hits.
+ *  @return 0 on success, -1 otherwise
+ */
+int
+init_ipc()
+{
+    struct epoll_event ev;
+    memset(&_ipc, 0, sizeof(_ipc));
+    // socket paths may be overridden by the environment
+    _ipc.inp_sock_path = getenv(ENV_INP_SOCK) ? getenv(ENV_INP_SOCK) :
+                         INP_SOCK_PATH;
+    _ipc.out_sock_path = getenv(ENV_OUT_SOCK) ? getenv(ENV_OUT_SOCK) :
+                         OUT_SOCK_PATH;
+    _ipc.log_sock_path = getenv(ENV_LOG_SOCK) ? getenv(ENV_LOG_SOCK) :
+                         LOG_SOCK_PATH;
+    init_linebuf(&_ipc.inp_buf, trace_sock);
+    init_linebuf(&_ipc.log_buf, trace_sock);
+    init_outq(&_ipc.outq);
+
+    if ((_ipc.epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+    {
+        return -1;
+    }
+
+    // watch terminal for keyboard hits
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = STDIN_FILENO;
+
+    if (epoll_ctl(_ipc.epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == -1)
+    {
+        close(_ipc.epfd);
+        return -1;
+    }
+
+    // watch message queue for messages of other threads
+    ev.data.fd = _queue.efd;
+
+    if (epoll_ctl(_ipc.epfd, EPOLL_CTL_ADD, _queue.efd, &ev) == -1)
+    {
+        close(_ipc.epfd);
+        return -1;
+    }
+
+    // watch terminal for resize events
+    ev.data.fd = _render.sigfd;
+
+    if (epoll_ctl(_ipc.epfd, EPOLL_CTL_ADD, _render.sigfd, &ev) == -1)
+    {
+        close(_ipc.epfd);
+        return -1;
+    }
+
+    // watch directories of sockets, so that sockets created by a
+    // (re)started core are connected immediately
+    if ((_ipc.ino_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+    {
+        _ipc.ino_fd = 0; // connection attempts are only retried
+    }
+    else
+    {
+        watch_sock_dir(_ipc.inp_sock_path);
+        watch_sock_dir(_ipc.out_sock_path);
+        watch_sock_dir(_ipc.log_sock_path);
+        ev.data.fd = _ipc.ino_fd;
+        epoll_ctl(_ipc.epfd, EPOLL_CTL_ADD, _ipc.ino_fd, &ev);
+    }
+
+    _ipc.seed         = now_ns() ^ getpid();
+    _ipc.backoff      = IPC_BACKOFF_MIN;
+    _ipc.next_connect = now_ms(); // connect immediately
+    return 0;
+}
+
+
+/**
+ *  Closes all open sockets of the global IPC structure.
+ *  Closed sockets are removed from the epoll instance automatically.
+ */
+void
+free_unix_socks()
+{
+    if (_ipc.inp_sock != 0)
+    {
+        close(_ipc.inp_sock);
+        _ipc.inp_sock = 0;
+    }
+
+    if (_ipc.out_sock != 0)
+    {
+        close(_ipc.out_sock);
+        _ipc.out_sock = 0;
+    }
+
+    if (_ipc.log_sock != 0)
+    {
+        close(_ipc.log_sock);
+        _ipc.log_sock = 0;
+    }
+
+    free_linebuf(&_ipc.inp_buf);
+    free_linebuf(&_ipc.log_buf);
+    _ipc.outq.off  = 0; // partially written message will be sent again
+    _ipc.connected = 0;
+    _ipc.pending   = 0;
+    _ipc.throttled = 0;
+}
+
+
+/**
+ *  Frees all ressources and closes all open sockets of the global IPC structure.
+ */
+void
+free_ipc()
+{
+    free_unix_socks();
+    free_outq(&_ipc.outq);
+
+    if (_ipc.epfd != 0)
+    {
+        close(_ipc.epfd);
+        _ipc.epfd = 0;
+    }
+
+    if (_ipc.ino_fd != 0)
+    {
+        close(_ipc.ino_fd);
+        _ipc.ino_fd = 0;
+    }
+}
+
+
+/**
+ *  Signals the event loop to reconnect to the UI unix sockets.
+ */
+void
+signal_reconnect()
+{
+    _ipc.reconnect = 1;
+}
+
+
+/**
+ *  Returns the current wall clock time.
+ *  Uses the coarse realtime clock, which is considerably cheaper than
+ *  time() on systems without vDSO support.
+ *  @return Seconds since the epoch
+ */
+time_t
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+
+/**
+ *  Returns the current time of the monotonic clock in milliseconds.
+ *  @return Milliseconds since an unspecified starting point
+ */
+long long
+now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ *  Returns the current time of the monotonic clock in nanoseconds.
+ *  @return Nanoseconds since an unspecified starting point
+ */
+long long
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/**
+ *  Connects to all UI unix sockets and registers them at the epoll instance.
+ *  Connecting does not block, so all sockets are connected at once.
+ *  Sockets connected by an attempt are kept, following attempts only
+ *  connect the sockets still missing. If a socket could not be connected,
+ *  the next attempt is scheduled with exponential backoff.
+ *  @return 0 on success, -1 otherwise
+ */
+int
+connect_ipc()
+{
+    struct epoll_event ev;
     int* socks[] =
     {
-        &_ipc.inp_sock,
-        &_ipc.out_sock,
-        &_ipc.log_sock
-    };
-    char* sock_paths[] =
+        &_ipc.inp_sock,
+        &_ipc.out_sock,
+        &_ipc.log_sock
+    };
+    char* sock_paths[] =
+    {
+        _ipc.inp_sock_path,
+        _ipc.out_sock_path,
+        _ipc.log_sock_path
+    };
+    // input and logging socket are read, output socket is only
+    // watched for hangups of the peer
+    uint32_t events[] =
+    {
+        EPOLLIN,
+        EPOLLRDHUP,
+        EPOLLIN
+    };
+    int failed = 0;
+
+    for (int i = 0; i < sizeof(socks)/sizeof(int*) ; i++)
+    {
+        if (*socks[i] != 0)
+        {
+            continue; // connected by a previous attempt
+        }
+
+        if ((*socks[i] = unix_connect(sock_paths[i])) == -1)
+        {
+            // failures are only reported once until connected again
+            if (_ipc.attempts == 0)
+            {
+                append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                                    "Connection to '%s' failed!\nReason: '%s'", sock_paths[i], strerror(errno));
+            }
+
+            *socks[i] = 0;
+            failed = 1;
+        }
+    }
+
+    if (failed)
+    {
+        _ipc.attempts++;
+        schedule_connect();
+        return -1;
+    }
+
+    for (int i = 0; i < sizeof(socks)/sizeof(int*) ; i++)
+    {
+        memset(&ev, 0, sizeof(ev));
+        ev.events  = events[i];
+        ev.data.fd = *socks[i];
+
+        if (epoll_ctl(_ipc.epfd, EPOLL_CTL_ADD, *socks[i], &ev) == -1)
+        {
+            append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                                "Connection to '%s' failed!\nReason: '%s'", sock_paths[i], strerror(errno));
+            free_unix_socks();
+            schedule_connect();
+            return -1;
+        }
+    }
+
+    if (offer_framing() == -1)
+    {
+        append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                            "Connection to '%s' failed!\nReason: '%s'", _ipc.inp_sock_path, strerror(errno));
+        free_unix_socks();
+        schedule_connect();
+        return -1;
+    }
+
+    trace_data(&_trace, TRACE_CONNECT, NULL, 0);
+    _ipc.connected = 1;
+    _ipc.has_nick  = 0;
+    _ipc.attempts  = 0;
+    _ipc.backoff   = IPC_BACKOFF_MIN;
+    append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                        "Connection established!");
+    flush_sock_out(); // send messages queued while disconnected
+    return 0;
+}
+
+
+/**
+ *  Offers the framed mode to the core if enabled by ENV_FRAMED.
+ *  Otherwise nothing is written and the input socket is read as text
+ *  lines. The offer has to reach the core completely, as a partial one
+ *  would be taken for the beginning of a message, so a short write
+ *  fails like an error.
+ *  @return 0 on success, -1 if the offer could not be written
+ */
+int
+offer_framing()
+{
+    ssize_t ret;
+
+    if (getenv(ENV_FRAMED) == NULL)
+    {
+        _ipc.framing = FRAMING_TEXT;
+        return 0;
+    }
+
+    // cores not supporting the framed mode never read the input socket
+    _ipc.framing = FRAMING_UNKNOWN;
+
+    while ((ret = write(_ipc.inp_sock, FRAME_HELLO, strlen(FRAME_HELLO))) == -1 &&
+           errno == EINTR);
+
+    if (ret == -1)
+    {
+        return -1;
+    }
+
+    if (ret != strlen(FRAME_HELLO))
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Schedules the next connection attempt.
+ *  The delay doubles with every attempt up to IPC_BACKOFF_MAX. A random
+ *  part of up to half of the delay (jitter) keeps many GUIs from
+ *  connecting to a restarted core at the same time.
+ */
+void
+schedule_connect()
+{
+    int delay = _ipc.backoff;
+    _ipc.backoff = delay * 2 < IPC_BACKOFF_MAX ? delay * 2 : IPC_BACKOFF_MAX;
+    _ipc.next_connect = now_ms() + delay / 2 + rand_r(&_ipc.seed) % (delay / 2 + 1);
+}
+
+
+/**
+ *  Watches the directory of a UI unix socket for created files.
+ *  @param path Path to UI unix socket
+ *  @see handle_inotify()
+ */
+void
+watch_sock_dir(char* path)
+{
+    char dir[PATH_MAX];
+    char* slash = strrchr(path, '/');
+    size_t len = slash == NULL ? 0 : slash > path ? slash - path : 1;
+
+    if (len >= sizeof(dir))
+    {
+        return;
+    }
+
+    memcpy(dir, path, len);
+    strcpy(dir + len, len > 0 ? "" : ".");
+    // directories already watched are only watched once
+    inotify_add_watch(_ipc.ino_fd, dir, IN_CREATE | IN_MOVED_TO);
+}
+
+
+/**
+ *  Handles files created within the directories of the UI unix sockets.
+ *  If one of the sockets appears while disconnected, it is connected
+ *  immediately instead of waiting for the next scheduled attempt.
+ */
+void
+handle_inotify()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char* names[] =
+    {
+        basename(_ipc.inp_sock_path),
+        basename(_ipc.out_sock_path),
+        basename(_ipc.log_sock_path)
+    };
+    struct inotify_event* ev;
+    int appeared = 0;
+    ssize_t len;
+
+    while ((len = read(_ipc.ino_fd, buf, sizeof(buf))) > 0)
+    {
+        for (char* p = buf; p < buf + len; p += sizeof(*ev) + ev->len)
+        {
+            ev = (struct inotify_event*) p;
+
+            for (int i = 0; i < sizeof(names)/sizeof(char*) && ev->len > 0; i++)
+            {
+                appeared |= strcmp(ev->name, names[i]) == 0;
+            }
+        }
+    }
+
+    if (appeared && !_ipc.connected)
+    {
+        _ipc.backoff      = IPC_BACKOFF_MIN;
+        _ipc.next_connect = now_ms();
+    }
+}
+
+
+/**
+ *  Pauses/resumes reading the input and logging UI unix sockets.
+ *  While paused, the sockets are not watched by the epoll instance and
+ *  incoming data is held back within the socket buffers.
+ *  @param on 1 to pause reading, 0 to resume
+ */
+void
+throttle_ipc(int on)
+{
+    struct epoll_event ev;
+
+    if (!_ipc.connected || _ipc.throttled == on)
+    {
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = on ? 0 : EPOLLIN;
+    ev.data.fd = _ipc.inp_sock;
+    epoll_ctl(_ipc.epfd, EPOLL_CTL_MOD, _ipc.inp_sock, &ev);
+    ev.data.fd = _ipc.log_sock;
+    epoll_ctl(_ipc.epfd, EPOLL_CTL_MOD, _ipc.log_sock, &ev);
+    _ipc.throttled = on;
+}
+
+
+/**
+ *  Closes all UI unix sockets and schedules an immediate reconnect.
+ */
+void
+reconnect_ipc()
+{
+    free_unix_socks();
+    _ipc.reconnect    = 0; // reset reconnect condition
+    _ipc.next_connect = now_ms();
+    append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM, "Reconnecting...");
+}
+
+
+/**
+ *  Handles a frame received from the input UI socket.
+ *  Frames of unknown type are skipped, so that the core may introduce
+ *  new types.
+ *  @param f       Pointer to frame
+ *  @param recv_ns Time the frame has been read in ns
+ *  @return Queue node of a message to append, NULL if the frame has
+ *          been handled completely
+ */
+QMSG_T*
+handle_frame(FRAME_T* f, long long recv_ns)
+{
+    QMSG_T* node = NULL;
+    char* nickname;
+
+    switch (f->type)
+    {
+        case FRAME_NICKNAME:
+            // only the first nickname of a connection is taken
+            if (_ipc.has_nick)
+            {
+                break;
+            }
+
+            if ((nickname = malloc(strlen(f->nickname) + 1)) != NULL)
+            {
+                strcpy(nickname, f->nickname);
+
+                if (_nickname != _self)
+                {
+                    free(_nickname);
+                }
+
+                _nickname = nickname;
+            }
+
+            _ipc.has_nick = 1;
+            break;
+
+        case FRAME_JOIN:
+        case FRAME_LEAVE:
+            if (*f->nickname == '\0')
+            {
+                break;
+            }
+
+            if (f->type == FRAME_JOIN)
+            {
+                join_contact(&_roster, f->nickname, f->body);
+            }
+            else
+            {
+                leave_contact(&_roster, f->nickname, f->body);
+            }
+
+            // rows of the roster window have changed
+            if (_roster.dirty_lo < _roster.top + _win_usr->h &&
+                _roster.dirty_hi > _roster.top)
+            {
+                mark_dirty(_win_usr);
+            }
+
+            break;
+
+        case FRAME_MESSAGE:
+            node = new_qmsg(f->nickname, MSGTYPE_CONTACT, f->body, f->len, f->time);
+            node->recv_ns = recv_ns;
+            break;
+    }
+
+    return node;
+}
+
+
+/**
+ *  Handles incoming data from the input UI socket.
+ *  Depending on the framing negotiated after connecting, text lines or
+ *  binary frames are read. At most IPC_LINES_PER_EVENT of them are
+ *  handled per call, so that keyboard hits will not be starved by a
+ *  flood of incoming lines. Their messages are appended at once.
+ */
+void
+handle_sock_inp()
+{
+    QMSG_T* batch[IPC_LINES_PER_EVENT];
+    char* line;     // line read from socket fd
+    FRAME_T f;
+    int ret = 0;
+    int n, count = 0;
+
+    if (_ipc.framing == FRAMING_UNKNOWN &&
+        (ret = detect_framing(&_ipc.inp_buf, _ipc.inp_sock)) > 0)
     {
-        INP_SOCK_PATH,
-        OUT_SOCK_PATH,
-        LOG_SOCK_PATH
-    };
-    pthread_t th_inp, th_out, th_log;
+        _ipc.framing = ret;
+    }
+
+    // is input socket initialized; no EOF and no error?
+    for (n = 0; _ipc.framing != FRAMING_UNKNOWN && n < IPC_LINES_PER_EVENT; n++)
+    {
+        if (_ipc.framing == FRAMING_BINARY)
+        {
+            ret = read_frame(&_ipc.inp_buf, _ipc.inp_sock, &f);
+        }
+        else if ((ret = read_line(&_ipc.inp_buf, _ipc.inp_sock, &line)) > 0 &&
+                 parse_line(line, &f) == -1)
+        {
+            continue;
+        }
+
+        if (ret <= 0)
+        {
+            break;
+        }
+
+        if ((batch[count] = handle_frame(&f, now_ns())) != NULL)
+        {
+            count++;
+        }
+    }
+
+    append_messages(_win_msg, batch, count);
+
+    if (n == IPC_LINES_PER_EVENT)
+    {
+        _ipc.pending = 1; // lines may be left within the line buffer
+        return;
+    }
+
+    if (ret == -1 && errno == EAGAIN)
+    {
+        return;
+    }
+
+    // on error, eof -> reconnect!
+    append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                        "No connection to input socket: '%s'", strerror(errno));
+    signal_reconnect();
+}
+
+
+/**
+ *  Initializes a queue of outgoing messages.
+ *  @param q Pointer to outgoing queue
+ */
+void
+init_outq(OUTQUEUE_T* q)
+{
+    memset(q, 0, sizeof(*q));
+}
+
+
+/**
+ *  Frees all pending messages of a queue of outgoing messages.
+ *  @param q Pointer to outgoing queue
+ */
+void
+free_outq(OUTQUEUE_T* q)
+{
+    for (int i = 0; i < q->count; i++)
+    {
+        free(q->msgs[(q->head + i) % OUTQ_MAX].iov_base);
+    }
+
+    init_outq(q);
+}
+
+
+/**
+ *  Appends a message to a queue of outgoing messages.
+ *  @param q   Pointer to outgoing queue
+ *  @param msg Message to send
+ *  @param len Length of message
+ *  @return 0 on success, -1 if the queue is full
+ */
+int
+push_outq(OUTQUEUE_T* q, char* msg, size_t len)
+{
+    struct iovec* iov;
+
+    if (q->count == OUTQ_MAX)
+    {
+        return -1;
+    }
+
+    iov = &q->msgs[(q->head + q->count) % OUTQ_MAX];
+
+    if ((iov->iov_base = malloc(len)) == NULL)
+    {
+        exit(1);
+    }
+
+    memcpy(iov->iov_base, msg, len);
+    iov->iov_len = len;
+    q->count++;
+    return 0;
+}
+
+
+/**
+ *  Writes pending messages of a queue of outgoing messages.
+ *  All pending messages are written with a single writev() without
+ *  blocking. Partially written messages remain within the queue and
+ *  will be continued with the next call.
+ *  @param q  Pointer to outgoing queue
+ *  @param fd Non-blocking file descriptor to write to
+ *  @return 0 on success or if the write would block, -1 on error
+ */
+int
+flush_outq(OUTQUEUE_T* q, int fd)
+{
+    struct iovec iov[OUTQ_IOV];
+    struct iovec* msg;
+    ssize_t ret;
+    int n;
+
+    while (q->count > 0)
+    {
+        for (n = 0; n < q->count && n < OUTQ_IOV; n++)
+        {
+            iov[n] = q->msgs[(q->head + n) % OUTQ_MAX];
+        }
+
+        // skip bytes of the first message that have already been written
+        iov[0].iov_base = (char*) iov[0].iov_base + q->off;
+        iov[0].iov_len -= q->off;
+
+        if ((ret = writev(fd, iov, n)) == -1)
+        {
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        }
+
+        // remove completely written messages
+        while (q->count > 0)
+        {
+            msg = &q->msgs[q->head];
+
+            if ((size_t) ret < msg->iov_len - q->off)
+            {
+                q->off += ret;
+                break;
+            }
+
+            ret -= msg->iov_len - q->off;
+            free(msg->iov_base);
+            q->off  = 0;
+            q->head = (q->head + 1) % OUTQ_MAX;
+            q->count--;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Writes pending outgoing messages to the output UI socket.
+ *  The output socket is watched for writability as long as messages
+ *  are pending. The number of pending messages is shown in the status
+ *  line.
+ */
+void
+flush_sock_out()
+{
+    struct epoll_event ev;
+
+    if (_ipc.connected && flush_outq(&_ipc.outq, _ipc.out_sock) == -1)
+    {
+        append_message(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                       "No connection to output socket: '%s'", strerror(errno));
+        signal_reconnect();
+    }
+
+    set_pending(_ipc.outq.count);
+
+    if (!_ipc.connected || _ipc.reconnect)
+    {
+        return;
+    }
+
+    // watch for writability only while messages are pending
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLRDHUP | (_ipc.outq.count > 0 ? EPOLLOUT : 0);
+    ev.data.fd = _ipc.out_sock;
+    epoll_ctl(_ipc.epfd, EPOLL_CTL_MOD, _ipc.out_sock, &ev);
+}
+
+
+/**
+ *  Handles outgoing data to the output UI socket.
+ *  The data is queued and written without blocking. If the socket is
+ *  not connected, the data will be sent after reconnecting.
+ *  @param msg String to send
+ *  @param len Length of string
+ *  @return 0 if the data has been queued, -1 if the queue is full
+ */
+int
+handle_sock_out(char* msg, size_t len)
+{
+    if (push_outq(&_ipc.outq, msg, len) == -1)
+    {
+        append_message(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                       "Message could not be sent: %d messages pending",
+                       _ipc.outq.count);
+        return -1;
+    }
+
+    flush_sock_out();
+    return 0;
+}
+
+
+/**
+ *  Handles incoming data from the logging UI socket.
+ *  At most IPC_LINES_PER_EVENT lines are handled per call, their
+ *  messages are appended at once.
+ */
+void
+handle_sock_log()
+{
+    QMSG_T* batch[IPC_LINES_PER_EVENT];
+    char* line;
+    int ret = 0;
+    int n;
+
+    // is logging socket initialized; no EOF and no error?
+    for (n = 0; n < IPC_LINES_PER_EVENT &&
+         (ret = read_line(&_ipc.log_buf, _ipc.log_sock, &line)) > 0; n++)
+    {
+        batch[n] = new_qmsg(SYSTEM, MSGTYPE_SYSTEM, line, ret - 1, 0);
+        batch[n]->recv_ns = now_ns();
+    }
+
+    append_messages(_win_msg, batch, n);
+
+    if (n == IPC_LINES_PER_EVENT)
+    {
+        _ipc.pending = 1; // lines may be left within the line buffer
+        return;
+    }
+
+    if (ret == -1 && errno == EAGAIN)
+    {
+        return;
+    }
+
+    // on error, eof -> reconnect!
+    append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                        "No connection to logging socket: '%s'", strerror(errno));
+    signal_reconnect();
+}
+
+
+/**
+ *  Event loop of the GUI.
+ *  Waits for keyboard hits as well as for data on the UI unix sockets
+ *  and dispatches them to their handlers. (Re)connecting to the UI unix
+ *  sockets is also done within this loop. Returns if function key F1 has
+ *  been typed or keyboard input has ended.
+ */
+void
+run_event_loop()
+{
+    struct epoll_event evs[IPC_MAX_EVENTS];
+    int timeout, frame_timeout, n, fd;
 
     // initialize global IPC structure
     if (init_ipc() == -1)
     {
         append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
-                            "Inter-Process-Communication failed!\n%sReason: '%s'", strerror(errno));
+                            "Inter-Process-Communication failed!\nReason: '%s'", strerror(errno));
+        return;
     }
 
     while (1)
     {
-        // connect to all UI sockets
-        for (int i = 0; i < sizeof(socks)/sizeof(int*) ; i++)
+        if (_ipc.reconnect)
+        {
+            reconnect_ipc();
+        }
+
+        if (!_ipc.connected && _ipc.next_connect <= now_ms())
+        {
+            connect_ipc();
+        }
+
+        // determine how long to wait for events
+        if (_ipc.pending && !_ipc.throttled)
+        {
+            timeout = 0;
+        }
+        else if (!_ipc.connected)
+        {
+            timeout = _ipc.next_connect - now_ms();
+            timeout = timeout < 0 ? 0 : timeout;
+        }
+        else
+        {
+            timeout = -1;
+        }
+
+        // queued messages are drained with the next frame
+        if (queue_length(&_queue) > 0)
+        {
+            mark_dirty(_win_msg);
+        }
+
+        // pause reading sockets until the queue has been drained
+        throttle_ipc(queue_length(&_queue) >= QUEUE_MAX);
+
+        // wake up for the next frame if windows are dirty
+        frame_timeout = render_timeout();
+
+        if (frame_timeout != -1 && (timeout == -1 || frame_timeout < timeout))
+        {
+            timeout = frame_timeout;
+        }
+
+        if ((n = epoll_wait(_ipc.epfd, evs, IPC_MAX_EVENTS, timeout)) == -1)
         {
-            if ((*socks[i] = unix_connect(sock_paths[i])) == -1)
+            if (errno == EINTR)
             {
-                append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
-                                    "Connection to '%s' failed!\nReason: '%s'", sock_paths[i], strerror(errno));
-                free_unix_socks();
-                sleep(ival);
-                i = -1;
                 continue;
             }
+
+            break;
         }
 
-        append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
-                            "Connection established!");
-        // start all socket threads
-        pthread_create(&th_inp, NULL, (void*) handle_sock_inp, NULL);
-        pthread_create(&th_log, NULL, (void*) handle_sock_log, NULL);
-        pthread_mutex_lock(
-            &_ipc.lock); // lock ipc mutex to start socket threads and to wait for reconnect cond.
+        // handle lines left within the line buffers
+        if (_ipc.pending && !_ipc.throttled)
+        {
+            _ipc.pending = 0;
+            handle_sock_inp();
+            handle_sock_log();
+        }
 
-        // check reconnect flag after wakeup if thread should reconnect to unix sockets
-        while (!_ipc.reconnect)
+        for (int i = 0; i < n && !_ipc.reconnect; i++)
         {
-            pthread_cond_wait(&_ipc.cond, &_ipc.lock);
+            fd = evs[i].data.fd;
+
+            if (fd == STDIN_FILENO)
+            {
+                // keyboard input ends if the terminal or pipe hangs up
+                if (read_input() == -1 || (evs[i].events & EPOLLHUP))
+                {
+                    free_ipc();
+                    return;
+                }
+            }
+            else if (fd == _queue.efd)
+            {
+                reset_wakeup(&_queue);
+            }
+            else if (fd == _render.sigfd)
+            {
+                resize_win();
+            }
+            else if (fd == _ipc.ino_fd)
+            {
+                handle_inotify();
+            }
+            else if ((fd == _ipc.inp_sock || fd == _ipc.log_sock) && _ipc.throttled)
+            {
+                // paused sockets still report hangups and errors, their
+                // lines must not be read until the queue has been drained
+                append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                                    "No connection to %s socket: '%s'",
+                                    fd == _ipc.inp_sock ? "input" : "logging",
+                                    strerror(ECONNRESET));
+                signal_reconnect();
+            }
+            else if (fd == _ipc.inp_sock)
+            {
+                handle_sock_inp();
+            }
+            else if (fd == _ipc.log_sock)
+            {
+                handle_sock_log();
+            }
+            else if (fd == _ipc.out_sock &&
+                     (evs[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+            {
+                append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM,
+                                    "No connection to output socket: '%s'", strerror(ECONNRESET));
+                signal_reconnect();
+            }
+            else if (fd == _ipc.out_sock)
+            {
+                flush_sock_out();
+            }
         }
 
-        pthread_mutex_unlock(&_ipc.lock);
-        // wait for threads to finish
-        free_unix_socks();  // close all open sockets
-        pthread_join(th_inp, NULL);
-        pthread_join(th_log, NULL);
-        append_message_sync(_win_msg, SYSTEM, MSGTYPE_SYSTEM, "Reconnecting...");
-        _ipc.reconnect = 0; // reset reconnect condition
+        render_frame();
     }
 
     free_ipc();
-    pthread_exit(NULL);
 }
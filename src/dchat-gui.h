@@ -21,6 +21,8 @@
 #ifndef DCHAT_GUI_H
 #define DCHAT_GUI_H
 
+#include "dchat-linebuf.h"
+
 
 //*********************************
 //         CHAT SETTINGS
@@ -29,6 +31,108 @@
 #define SYSTEM    "SYSTEM"
 #define PROMPT    "$\n"
 #define SEPARATOR " - "
+#define DATE_FORMAT "%d. %b %Y %H:%M "
+#define DATE_SIZE 100  // size of buffer of a formatted date
+#define MSG_SEGMENTS 7 // number of segments of a chat line
+#define DATE_CACHE 16  // number of cached formatted minutes per thread
+#define INPUT_INIT 256    // initial size of input line buffer in bytes
+#define INPUT_MAX  65536  // maximum length of input line in bytes
+#define PASTE_ON      "\033[?2004h" // enables bracketed paste of the terminal
+#define PASTE_OFF     "\033[?2004l" // disables bracketed paste of the terminal
+#define PASTE_BEGIN   "\033[200~"   // sent by the terminal before pasted text
+#define PASTE_END     "\033[201~"   // sent by the terminal after pasted text
+#define PASTE_CHUNK   4096          // bytes of pasted text read at once
+#define PASTE_TIMEOUT 100           // ms to wait for the rest of pasted text
+#define KEY_PASTE     (KEY_MAX + 1) // key code of PASTE_BEGIN
+#define WIDTH_CACHE   0x20000       // code points with cached display width
+#define WIDTH_INVALID '?'           // shown instead of unprintable characters
+#define RUN_SPACE     0x80          // added to the width of a space within a cell run
+
+
+//*********************************
+//         STORE SETTINGS
+//*********************************
+#define STORE_MAX_MSGS  100000           // maximum number of messages in history
+#define STORE_MAX_BYTES (16*1024*1024)   // maximum bytes of messages in history
+#define STORE_INIT_MSGS 256              // initial capacity of message store
+#define QUEUE_DRAIN     1024             // maximum messages moved into store per frame
+#define QUEUE_MAX       16384            // queued messages that pause reading sockets
+#define INDEX_BITS      16               // 2^INDEX_BITS posting lists of search index
+#define INDEX_BLOCK     4                // 2^INDEX_BLOCK messages share one posting
+#define SEARCH_LENGTH   64               // maximum length of search query
+#define SEARCH_SCAN     16384            // messages searched for queries shorter than a trigram
+#define RUN_CACHE_CELLS (1024*1024)      // maximum cells of chat lines cached by store
+
+
+//*********************************
+//         RENDER SETTINGS
+//*********************************
+#define RENDER_FPS 60 // maximum number of frames rendered per second
+#define RATIO_HEIGHT 0.95 // height of message window relative to available rows
+#define RATIO_WIDTH  0.75 // width of message window relative to available columns
+#define STATUS_LENGTH 256 // maximum length of status line
+#define ENV_HEADLESS  "DCHAT_HEADLESS" // COLSxROWS: render into memory instead of terminal
+#define ENV_SNAPSHOT  "DCHAT_SNAPSHOT" // file the headless screen is written to on exit
+#define HEADLESS_TERM "xterm"          // terminal type emulated by the headless backend
+
+
+//*********************************
+//         STATS SETTINGS
+//*********************************
+#define ENV_STATS     "DCHAT_STATS" // file latency statistics are written to on exit
+#define HIST_SUB_BITS 6  // 2^(HIST_SUB_BITS-1) buckets per power of two (~3% precision)
+#define HIST_MAX_BITS 40 // latencies of 2^HIST_MAX_BITS ns and more are clamped
+#define HIST_BUCKETS  (((HIST_MAX_BITS - HIST_SUB_BITS) << (HIST_SUB_BITS - 1)) + \
+                       (1 << HIST_SUB_BITS))
+#define STATS_WIDTH   60 // width of statistics overlay
+#define STATS_HEIGHT  6  // height of statistics overlay
+
+
+//*********************************
+//        HISTORY SETTINGS
+//*********************************
+#define ENV_HISTORY    "DCHAT_HISTORY"  // file the history is kept in, no history if unset
+#define HIST_MAX_SIZE  (64*1024*1024)   // size at which the history file is rotated
+#define HIST_ROTATED   ".1"             // suffix of the rotated history file
+#define HIST_SIGNATURE "DCHIST1\n"      // first bytes of a history file
+#define HIST_SIG_LEN   8                // length of signature
+#define HIST_MAGIC     0x52484344       // magic number of records ("DCHR")
+#define HIST_SCREENS   16               // screens of history loaded on startup
+#define HIST_BUF_MAX   (4*1024*1024)    // unwritten bytes until records are dropped
+
+
+//*********************************
+//         TRACE SETTINGS
+//*********************************
+#define ENV_CAPTURE     "DCHAT_CAPTURE" // file data received on the UI sockets is captured to
+#define TRACE_SIGNATURE "DCTRACE1"      // first bytes of a trace file
+#define TRACE_SIG_LEN   8               // length of signature
+#define TRACE_BUF       (1024*1024)     // bytes of trace buffered before writing
+
+
+//*********************************
+//         ROSTER SETTINGS
+//*********************************
+#define ROSTER_BUCKETS 256 // initial number of hash buckets, power of two
+
+
+//*********************************
+//         IPC SETTINGS
+//*********************************
+#define ENV_INP_SOCK        "DCHAT_INP_SOCK" // overrides INP_SOCK_PATH
+#define ENV_OUT_SOCK        "DCHAT_OUT_SOCK" // overrides OUT_SOCK_PATH
+#define ENV_LOG_SOCK        "DCHAT_LOG_SOCK" // overrides LOG_SOCK_PATH
+#define ENV_FRAMED          "DCHAT_FRAMED"   // offer the framed mode to the core if set
+#define IPC_LINES_PER_EVENT 256  // maximum lines handled per socket event
+#define IPC_MAX_EVENTS      8    // maximum events returned by epoll at once
+#define IPC_BACKOFF_MIN     10   // ms until the first retry of a failed connection attempt
+#define IPC_BACKOFF_MAX     5000 // maximum ms between connection attempts
+#define OUTQ_MAX            128  // maximum number of pending outgoing messages
+#define OUTQ_IOV            16   // maximum messages written at once
+#define FRAME_HELLO         "FRAMED 1\n" // offer of framed mode sent on the input socket
+#define FRAME_MAGIC         "\0DCF" // first bytes of input socket if offer is accepted
+#define FRAME_MAGIC_LEN     4
+#define FRAME_MAX           (1024*1024) // maximum length of nickname and body of a frame
 
 
 //*********************************
@@ -58,9 +162,99 @@ typedef struct DWINDOW
 } DWINDOW_T;
 
 
+/*!
+ * Framing of the input unix socket.
+ * If ENV_FRAMED is set, the GUI offers the framed mode right after
+ * connecting. A core accepting the offer sends FRAME_MAGIC before its
+ * first frame, all other cores keep sending newline terminated text
+ * lines. Without ENV_FRAMED nothing is offered and text lines are read.
+ */
+enum framing
+{
+    FRAMING_UNKNOWN, //!< No data received since connecting
+    FRAMING_TEXT,    //!< Lines in the form nickname;message
+    FRAMING_BINARY   //!< Length-prefixed frames
+};
+
+
+/*!
+ * Types of frames received from the input unix socket.
+ */
+enum frametypes
+{
+    FRAME_MESSAGE = 1, //!< Message of a contact
+    FRAME_NICKNAME,    //!< Nickname of the user, body is empty
+    FRAME_JOIN,        //!< Contact has joined, body is its onion ID
+    FRAME_LEAVE        //!< Contact has left, body is its onion ID
+};
+
+
+/*!
+ * Header of a binary frame.
+ * Followed by the nickname and the body of the frame, each of them
+ * terminated by \0, so that both can be used in place. Fields are in
+ * host byte order.
+ */
+typedef struct FRAMEHDR
+{
+    uint32_t len;      //!< Length of body without \0
+    uint16_t type;     //!< Type of frame: enum frametypes
+    uint16_t nick_len; //!< Length of nickname without \0
+    int64_t  time;     //!< Time the message has been sent, 0 for time of receipt
+} FRAMEHDR_T;
+
+
+/*!
+ * Frame received from the input unix socket.
+ * Text lines are parsed into frames as well. Nickname and body point
+ * into the buffer of the line reader and are \0 terminated.
+ */
+typedef struct FRAME
+{
+    int    type;     //!< Type of frame: enum frametypes
+    char*  nickname; //!< Nickname of sender or contact
+    char*  body;     //!< Message text or onion ID
+    size_t len;      //!< Length of body
+    time_t time;     //!< Time the message has been sent, 0 for time of receipt
+} FRAME_T;
+
+
+/*!
+ * Line editor of the input window.
+ * The line is held within a gap buffer: the text before the cursor is
+ * stored at the beginning, the text behind the cursor at the end of the
+ * buffer, so inserting and deleting at the cursor is O(1). Lines may be
+ * longer than the input window, which scrolls horizontally to keep the
+ * cursor visible.
+ */
+typedef struct EDITOR
+{
+    char*  buf;     //!< Gap buffer
+    size_t size;    //!< Allocated size of buffer
+    size_t gap;     //!< Offset of gap, equals the cursor position
+    size_t gap_end; //!< Offset behind gap
+    size_t scroll;  //!< Position of first character shown
+} EDITOR_T;
+
+
+/*!
+ * Queue of outgoing messages.
+ * Ring buffer of messages that have not been written completely
+ * to the output unix socket.
+ */
+typedef struct OUTQUEUE
+{
+    struct iovec msgs[OUTQ_MAX]; //!< Ring buffer of pending messages
+    int    head;                 //!< Index of oldest pending message
+    int    count;                //!< Number of pending messages
+    size_t off;                  //!< Bytes of oldest message already written
+} OUTQUEUE_T;
+
+
 /*!
  * Structure for IPC used for the GUI.
- * Specifies input, output and logging unix socket for the UI.
+ * Specifies input, output and logging unix socket for the UI
+ * as well as the epoll instance of the event loop watching them.
  */
 typedef struct ipc
 {
@@ -70,12 +264,71 @@ typedef struct ipc
     int   inp_sock;       //!< File descriptor of input unix socket
     int   out_sock;       //!< File descriptor of output unix socket
     int   log_sock;       //!< File descriptor of logging unix socket
-    pthread_mutex_t lock; //!< Mutex for reconnecting the ipc thread
-    pthread_cond_t cond;  //!< Condition for reconnect
-    int reconnect;        //!< Value of reconnect condition: 1 = reconnect
+    LINEBUF_T inp_buf;    //!< Line reader of input unix socket
+    LINEBUF_T log_buf;    //!< Line reader of logging unix socket
+    int   framing;        //!< Framing of input unix socket: enum framing
+    OUTQUEUE_T outq;      //!< Messages pending on output unix socket
+    int   epfd;           //!< File descriptor of epoll instance
+    int   connected;      //!< 1 if all unix sockets are connected
+    int   has_nick;       //!< 1 if nickname has been received from core
+    int   pending;        //!< 1 if line buffers may contain unhandled lines
+    int   throttled;      //!< 1 if reading sockets is paused
+    int   reconnect;      //!< Value of reconnect condition: 1 = reconnect
+    long long next_connect; //!< Time of next connection attempt in ms
+    int   backoff;        //!< Delay of next connection attempt in ms
+    int   attempts;       //!< Failed connection attempts since last connection
+    unsigned int seed;    //!< Seed of jitter of connection attempts
+    int   ino_fd;         //!< Inotify instance watching directories of sockets
 } ipc;
 
 
+/*!
+ * Structure of the render scheduler.
+ * Chat windows are not flushed to the terminal on every change.
+ * Instead they are marked dirty and flushed together once per frame.
+ */
+typedef struct render
+{
+    int dirty;            //!< Bitmask of dirty windows: 1 << enum windows, RENDER_STATUS
+    int frame_ival;       //!< Minimum time between two frames in ms
+    long long last_frame; //!< Time the last frame has been rendered in ms
+    int sigfd;            //!< Signalfd receiving resize events (SIGWINCH)
+    char status[STATUS_LENGTH]; //!< Text of status line
+    int pending;          //!< Messages pending on output socket, shown right of status text
+} render;
+
+
+/*!
+ * Render backend.
+ * Provides the ncurses screen all chat windows are staged to and
+ * presents the staged windows once per frame.
+ */
+typedef struct BACKEND
+{
+    char* name;            //!< Name of backend
+    int  (*start)(void);   //!< Creates the screen, returns -1 on error
+    void (*stop)(void);    //!< Releases the screen
+    void (*present)(void); //!< Presents all staged windows
+} BACKEND_T;
+
+
+/*!
+ * Structure of the headless render backend.
+ * Windows are rendered into an in-memory screen grid instead of a
+ * terminal. Keyboard hits are read from standard input.
+ */
+typedef struct HEADLESS
+{
+    int     rows;     //!< Number of rows of screen
+    int     cols;     //!< Number of columns of screen
+    int     y_cursor; //!< Cursor row position of screen
+    int     x_cursor; //!< Cursor column position of screen
+    cchar_t* cells;   //!< Screen grid of rows * cols cells
+    SCREEN* scr;      //!< Ncurses screen
+    FILE*   out;      //!< Sink of terminal output of ncurses
+} HEADLESS_T;
+
+
 /*!
  * Source of message.
  * This enum defines the possible sources of messages.
@@ -91,6 +344,351 @@ enum msgtypes
 };
 
 
+/*!
+ * Cell run of a chat line.
+ * The chat line of a message laid out into attributed cells, so that it
+ * is drawn by copying cells instead of formatting it again. The rows of
+ * the chat line are kept for the width they have been wrapped at last.
+ */
+typedef struct RUN
+{
+    int len;               //!< Number of cells
+    int nick_col;          //!< Column of the nickname within the first row
+    int w;                 //!< Width the rows have been wrapped at, 0 if not yet
+    int hang;              //!< Indent of continuation rows at this width
+    int rows;              //!< Number of rows at this width
+    int* starts;           //!< Index of first cell of each row
+    unsigned char* widths; //!< Columns of each cell, 0 for a line break,
+                           //!< RUN_SPACE added for spaces
+    cchar_t cells[];       //!< Characters with attributes applied
+} RUN_T;
+
+
+/*!
+ * Message record.
+ * Structured representation of a chat message within the message store.
+ */
+typedef struct MSG
+{
+    time_t time;    //!< Time the message has been received
+    int    type;    //!< Type of message: enum msgtypes
+    char*  nickname; //!< Nickname of sender, shares its allocation with text
+    char*  text;    //!< Text of message
+    size_t len;     //!< Length of text
+    void*  mem;     //!< Allocation holding nickname and text, freed on drop
+    RUN_T* run;     //!< Cached cell run of chat line, NULL if not built yet
+} MSG_T;
+
+
+/*!
+ * Node of the lock-free message queue.
+ * Node, nickname and text of the message share one allocation.
+ */
+typedef struct QMSG
+{
+    struct QMSG* _Atomic next; //!< Next node within queue
+    long long recv_ns;         //!< Time the message has been read in ns, 0 if unknown
+    long long enq_ns;          //!< Time the message has been queued in ns
+    MSG_T msg;                 //!< Queued message record
+} QMSG_T;
+
+
+/*!
+ * Lock-free multi-producer/single-consumer message queue.
+ * Any thread may push messages, only the thread running the event loop
+ * pops them and moves them into the message store.
+ */
+typedef struct MSGQUEUE
+{
+    QMSG_T* _Atomic head; //!< Node pushed last by producers
+    QMSG_T* tail;         //!< Node popped next by the consumer
+    QMSG_T  stub;         //!< Stub node, the queue is never empty
+    atomic_size_t len;    //!< Number of queued messages
+    int     efd;          //!< Eventfd to wake up the event loop
+    int     drain;        //!< Maximum messages drained per frame, 0 for no limit
+} MSGQUEUE_T;
+
+
+/*!
+ * Posting list of the search index.
+ * Ascending numbers of message blocks containing a trigram, stored as
+ * varint encoded differences.
+ */
+typedef struct POSTINGS
+{
+    unsigned char* buf; //!< Encoded block numbers
+    size_t len;         //!< Length of encoded block numbers
+    size_t size;        //!< Allocated size of buffer
+} POSTINGS_T;
+
+
+/*!
+ * Generation of the search index.
+ * Maps hashed trigrams of message texts to the blocks of 2^INDEX_BLOCK
+ * consecutive messages containing them. Indexing blocks instead of single
+ * messages keeps frequent trigrams from being added over and over again.
+ * Hash collisions only produce candidates that do not match.
+ */
+typedef struct TRIGRAMS
+{
+    POSTINGS_T lists[1 << INDEX_BITS];        //!< Posting lists by trigram hash
+    unsigned long long last[1 << INDEX_BITS]; //!< Block added last to list + 1, 0 if empty
+    unsigned long long first;                 //!< Sequence number of first indexed message
+} TRIGRAMS_T;
+
+
+/*!
+ * Search index.
+ * Messages are added to the newer of two generations. Once the store
+ * begins to drop messages of the newer generation, a new one is started,
+ * and the older generation is freed as soon as all of its messages have
+ * been dropped. Thus the index covers at most about twice the stored
+ * messages and never has to be rebuilt.
+ */
+typedef struct MSGINDEX
+{
+    TRIGRAMS_T* gens[2]; //!< Older and newer generation, NULL if not existing
+} MSGINDEX_T;
+
+
+/*!
+ * Message store.
+ * Bounded ring buffer holding the message history. If one of the
+ * capacities is exceeded, the oldest messages will be dropped.
+ */
+typedef struct MSGSTORE
+{
+    MSG_T* msgs;      //!< Ring buffer of message records
+    size_t size;      //!< Allocated number of message records
+    size_t head;      //!< Index of oldest message record
+    size_t count;     //!< Number of stored messages
+    size_t bytes;     //!< Number of bytes of stored message texts
+    unsigned long long seq; //!< Sequence number of oldest message
+    size_t max_msgs;  //!< Maximum number of messages, 0 for no limit
+    size_t max_bytes; //!< Maximum number of bytes of message texts, 0 for no limit
+    MSGINDEX_T* index; //!< Search index kept up to date, NULL for none
+    size_t run_cells; //!< Number of cells of cached runs
+} MSGSTORE_T;
+
+
+/*!
+ * Message view.
+ * Position of a chat window within the message history. The view is
+ * anchored at the message shown in the top row of the window.
+ */
+typedef struct MSGVIEW
+{
+    unsigned long long seq; //!< Sequence number of message in top row
+    int row;                //!< Row of this message shown in top row
+    int follow;             //!< 1 if the view follows the newest messages
+} MSGVIEW_T;
+
+
+/*!
+ * State of the incremental search.
+ * Messages are searched from the newest to the oldest one. Candidates
+ * are taken from the search index and verified one by one, so that only
+ * as many messages are compared as needed to find the next match.
+ */
+typedef struct SEARCH
+{
+    int    active;                    //!< 1 if the search is active
+    char   query[SEARCH_LENGTH + 1];  //!< Search query
+    int    len;                       //!< Length of query
+    unsigned long long* cands;        //!< Ascending block numbers of candidates
+    size_t count;                     //!< Number of candidates
+    size_t size;                      //!< Allocated number of candidates
+    size_t split;                     //!< Number of candidates of older generation
+    int    cand_len;                  //!< Length of query the candidates belong to
+    unsigned long long gen;           //!< First message of newer generation of candidates
+    unsigned long long end;           //!< Sequence number behind last candidate
+    int    all;                       //!< 1 if every message is a candidate
+    int    found;                     //!< 1 if a message matches the query
+    unsigned long long match;         //!< Sequence number of matching message
+    MSGVIEW_T saved;                  //!< View before search, restored on cancel
+} SEARCH_T;
+
+
+/*!
+ * Contact shown within the roster.
+ * Contacts are identified by their onion ID, or by their nickname if
+ * no onion ID has been announced. Key and nickname share one allocation.
+ */
+typedef struct CONTACT
+{
+    char* key;            //!< Onion ID or nickname identifying the contact
+    char* nickname;       //!< Nickname shown within the roster
+    unsigned int hash;    //!< Hash value of key
+    struct CONTACT* next; //!< Next contact within the same hash bucket
+} CONTACT_T;
+
+
+/*!
+ * Roster of active contacts.
+ * Contacts are looked up by a chained hash table, while the roster window
+ * shows them sorted by nickname. A join or leave inserts or removes one
+ * entry of the sorted view, and only the rows from this entry on are
+ * redrawn.
+ */
+typedef struct ROSTER
+{
+    CONTACT_T** buckets; //!< Hash table of contacts by key
+    size_t nbuckets;     //!< Number of hash buckets, power of two
+    CONTACT_T** sorted;  //!< Contacts sorted by nickname
+    size_t count;        //!< Number of contacts
+    size_t size;         //!< Allocated number of sorted contacts
+    size_t top;          //!< Index of contact shown in top row
+    size_t dirty_lo;     //!< First changed index of sorted contacts
+    size_t dirty_hi;     //!< Index behind last changed sorted contact
+} ROSTER_T;
+
+
+/*!
+ * Entry of the cache of formatted dates.
+ * Holds the formatted date of one minute.
+ */
+typedef struct DATECACHE
+{
+    time_t minute;        //!< Minutes since the epoch
+    int    valid;         //!< 1 if the entry holds a formatted date
+    size_t len;           //!< Length of formatted date
+    char   dt[DATE_SIZE]; //!< Formatted date
+} DATECACHE_T;
+
+
+/*!
+ * Latency histogram.
+ * Log-linear histogram in the style of HdrHistogram: values are counted
+ * exactly below 2^HIST_SUB_BITS, above they are counted within
+ * 2^(HIST_SUB_BITS-1) buckets per power of two.
+ */
+typedef struct HISTOGRAM
+{
+    unsigned long long counts[HIST_BUCKETS]; //!< Number of values per bucket
+    unsigned long long total; //!< Number of recorded values
+    long long max;            //!< Maximum recorded value
+} HISTOGRAM_T;
+
+
+/*!
+ * Latency statistics of messages.
+ * Messages are timestamped when they are read from a socket, queued,
+ * moved into the message store by a frame and flushed by that frame.
+ */
+typedef struct STATS
+{
+    HISTOGRAM_T recv_enq;     //!< Latency from receive to enqueue
+    HISTOGRAM_T enq_render;   //!< Latency from enqueue to render
+    HISTOGRAM_T render_flush; //!< Latency from render to flush
+    int visible;              //!< 1 if the statistics overlay is shown
+} STATS_T;
+
+
+/*!
+ * Header of a record within the history file.
+ * A record consists of header, nickname, message text, zero padding to a
+ * multiple of 8 bytes and trailer. The trailer allows to read the
+ * history file backwards.
+ */
+typedef struct HISTREC
+{
+    uint32_t size;     //!< Size of record including header and trailer
+    uint16_t type;     //!< Type of message: enum msgtypes
+    uint16_t nick_len; //!< Length of nickname
+    int64_t  time;     //!< Time the message has been received
+    uint32_t text_len; //!< Length of message text
+    uint32_t magic;    //!< HIST_MAGIC
+} HISTREC_T;
+
+
+/*!
+ * Trailer of a record within the history file.
+ */
+typedef struct HISTTRL
+{
+    uint32_t size;  //!< Size of record including header and trailer
+    uint32_t magic; //!< HIST_MAGIC
+} HISTTRL_T;
+
+
+/*!
+ * Persistent message history.
+ * Append-only file of message records. Records are collected by the
+ * event loop and written by a separate thread, so that a slow disk
+ * never blocks the GUI.
+ */
+typedef struct HISTLOG
+{
+    int    fd;               //!< File descriptor of history file, -1 if closed
+    char*  path;             //!< Path of history file
+    size_t file_size;        //!< Size of history file, only used by the writer thread
+    char*  map;              //!< History file mapped on startup, NULL if unmapped
+    size_t map_size;         //!< Size of mapping
+    size_t end;              //!< End of last valid record within mapping
+    char*  buf;              //!< Records not handed to the writer thread yet
+    size_t len;              //!< Length of records within buffer
+    size_t size;             //!< Allocated size of buffer
+    unsigned long dropped;   //!< Records dropped because the writer fell behind
+                             //!< or writing them failed
+    int    stop;             //!< 1 if the writer thread has to stop
+    pthread_t thread;        //!< Writer thread
+    pthread_mutex_t lock;    //!< Protects buffer and stop condition
+    pthread_cond_t  cond;    //!< Signals records or stop to the writer thread
+} HISTLOG_T;
+
+
+/*!
+ * Source of data within a trace.
+ * A trace records the data received on the input and logging unix
+ * socket. Every (re)connection to the core is recorded as well, since
+ * the core starts each connection anew.
+ */
+enum tracesources
+{
+    TRACE_INP,    //!< Data received on the input unix socket
+    TRACE_LOG,    //!< Data received on the logging unix socket
+    TRACE_CONNECT //!< UI unix sockets have been connected, no data
+};
+
+
+/*!
+ * Header of a record within a trace file.
+ * A trace file starts with TRACE_SIGNATURE followed by the records.
+ * Each header is followed by len bytes of data as received.
+ */
+typedef struct TRACEREC
+{
+    uint64_t time;   //!< Time since start of capture in ns
+    uint32_t len;    //!< Length of data
+    uint16_t source; //!< Source of data: enum tracesources
+    uint16_t pad;    //!< Unused, 0
+} TRACEREC_T;
+
+
+/*!
+ * Capture of the data received on the UI unix sockets.
+ * Data is captured exactly as it is read, so that a replay passes the
+ * same reads through the same code.
+ */
+typedef struct TRACE
+{
+    FILE*     f;     //!< Trace file, NULL if nothing is captured
+    long long start; //!< Start of capture in ns
+} TRACE_T;
+
+
+/*!
+ * Segment of a chat line.
+ * Part of a chat line that is printed with the same attributes.
+ */
+typedef struct SEGMENT
+{
+    const char* str; //!< Text of segment, not \0 terminated
+    size_t len;      //!< Length of text
+    chtype attr;     //!< Ncurses attributes of segment
+} SEGMENT_T;
+
+
 /*!
  * Type of window.
  * This enum defines constants for the possible windows
@@ -105,6 +703,12 @@ enum windows
 };
 
 
+/*!
+ * Dirty flag of the status line within the render scheduler.
+ */
+#define RENDER_STATUS (1 << WINDOW_AMOUNT)
+
+
 /*!
  * Type of color.
  * This enum defines all possible colors
@@ -132,7 +736,11 @@ enum colors
 //*********************************
 void init_colors(void);
 void init_wins();
+void layout_gui(float ratio_height, float ratio_width);
 void init_gui(float ratio_height, float ratio_width);
+void place_stats();
+void place_win(DWINDOW_T* win);
+void resize_gui();
 void start_gui();
 void free_wins();
 void stop_gui();
@@ -141,13 +749,30 @@ void stop_gui();
 //*********************************
 //        RENDER FUNCTIONS
 //*********************************
-WINDOW* create_padwin(int max_height, int max_width, int height, int width,
-                      int starty, int startx, const int col_bkgd);
 WINDOW* create_win(int height, int width, int starty, int startx,
                    const int col_bkgd);
-void refresh_padwin(DWINDOW_T* win);
 void refresh_current();
 void refresh_screen();
+void mark_dirty(DWINDOW_T* win);
+void set_status(char* fmt, ...);
+void set_pending(int count);
+void set_frame_rate(int fps);
+int render_timeout();
+void render_status();
+void render_frame();
+
+
+//*********************************
+//        BACKEND FUNCTIONS
+//*********************************
+int init_backend();
+int term_start(void);
+void term_stop(void);
+void term_present(void);
+int headless_start(void);
+void headless_stop(void);
+void headless_present(void);
+void snapshot_screen(FILE* f);
 
 
 //*********************************
@@ -155,23 +780,22 @@ void refresh_screen();
 //*********************************
 int current_winnr();
 DWINDOW_T* get_win(int winnr);
-void resize_win(int signum);
-void scroll_win(DWINDOW_T* win, int n);
+void resize_win();
 void move_win(DWINDOW_T* win, int y, int x);
-void set_row_position(DWINDOW_T* win, int y);
-void set_row_cursor(DWINDOW_T* win, int y);
-void col_position(DWINDOW_T* win, int n);
-void col_cursor(DWINDOW_T* win, int n);
 
 
 //*********************************
 //    INPUT HANDLER FUNCTIONS
 //*********************************
-void read_input();
+int read_input();
+void read_paste();
 void handle_keyboard_hit(int ch);
 void on_key_tab();
 void on_key_enter();
 void on_key_backspace();
+void on_key_delete();
+void on_key_home();
+void on_key_end();
 void on_key_up();
 void on_page_up();
 void on_key_down();
@@ -179,36 +803,205 @@ void on_page_down();
 void on_key_left();
 void on_key_right();
 void on_key_ascii(int ch);
+void on_key_stats();
+void on_key_search();
+void on_search_key(int ch);
+
+
+//*********************************
+//         TEXT FUNCTIONS
+//*********************************
+void init_widths();
+int char_width(wchar_t wc);
+int next_char(const char* s, size_t len, wchar_t* wc, int* width);
+void draw_char(WINDOW* win, int y, int x, wchar_t wc, chtype attr);
+int add_text(WINDOW* win, const char* s, size_t len, int w);
+
+
+//*********************************
+//      LINE EDITOR FUNCTIONS
+//*********************************
+void free_editor(EDITOR_T* ed);
+size_t editor_len(EDITOR_T* ed);
+int editor_insert(EDITOR_T* ed, char ch);
+long editor_chars(EDITOR_T* ed, long n);
+int editor_delete(EDITOR_T* ed, int n);
+int editor_move(EDITOR_T* ed, long n);
+char* editor_text(EDITOR_T* ed, size_t* len);
+void editor_clear(EDITOR_T* ed);
+void render_editor(EDITOR_T* ed, DWINDOW_T* win);
 
 
 //*********************************
 //       PRINT FUNCTIONS
 //*********************************
-int print_string(DWINDOW_T* win, char* str, chtype attr);
-int print_line_self(DWINDOW_T* win, char* nickname, char* msg);
-int print_line_contact(DWINDOW_T* win, char* nickname, char* msg);
-int print_line_system(DWINDOW_T* win, char* nickname, char* msg);
-int print_line(DWINDOW_T* win, char* nickname, chtype nickname_attr,  char* msg,
-               chtype msg_attr);
+void message_attrs(int type, chtype* nickname_attr, chtype* msg_attr);
+size_t format_date(time_t time, char* dt);
+int message_segments(MSG_T* msg, char* dt, SEGMENT_T* seg);
+RUN_T* build_run(MSG_T* msg);
+RUN_T* message_run(MSGSTORE_T* store, MSG_T* msg);
+void layout_run(RUN_T* run, int w);
+void draw_cells(WINDOW* win, RUN_T* run, int start, int end, int x, int w, int y);
+int draw_message(WINDOW* win, RUN_T* run, int w, int row, int y, int n);
+int message_rows(MSGSTORE_T* store, MSG_T* msg, int w);
+size_t view_index(MSGVIEW_T* view, MSGSTORE_T* store);
+void view_bottom(MSGVIEW_T* view, MSGSTORE_T* store, DWINDOW_T* win);
+void scroll_view(MSGVIEW_T* view, MSGSTORE_T* store, DWINDOW_T* win, int n);
+void render_view(MSGVIEW_T* view, MSGSTORE_T* store, DWINDOW_T* win);
 void vappend_message(DWINDOW_T* win, char* nickname, int type, char* fmt,
                      va_list args);
+void append_raw(DWINDOW_T* win, char* nickname, int type, char* text,
+                size_t len);
 void append_message(DWINDOW_T* win, char* nickname, int type, char* fmt, ...);
+void append_messages(DWINDOW_T* win, QMSG_T** nodes, size_t n);
 void append_message_sync(DWINDOW_T* win, char* nickname, int type, char* fmt,
                          ...);
 
 
 
+//*********************************
+//      MESSAGE QUEUE FUNCTIONS
+//*********************************
+int init_queue(MSGQUEUE_T* q, int drain);
+void free_queue(MSGQUEUE_T* q);
+QMSG_T* alloc_qmsg(char* nickname, int type, size_t len, time_t time);
+QMSG_T* new_qmsg(char* nickname, int type, char* text, size_t len,
+                 time_t time);
+QMSG_T* vformat_qmsg(char* nickname, int type, char* fmt, va_list args);
+void link_node(MSGQUEUE_T* q, QMSG_T* node);
+void push_message(MSGQUEUE_T* q, QMSG_T* node);
+void push_messages(MSGQUEUE_T* q, QMSG_T** nodes, size_t n);
+QMSG_T* pop_message(MSGQUEUE_T* q);
+size_t queue_length(MSGQUEUE_T* q);
+void wakeup_queue(MSGQUEUE_T* q);
+void reset_wakeup(MSGQUEUE_T* q);
+int drain_queue(MSGQUEUE_T* q, MSGSTORE_T* store, STATS_T* stats,
+                HISTLOG_T* hist);
+
+
+//*********************************
+//      MESSAGE STORE FUNCTIONS
+//*********************************
+void init_store(MSGSTORE_T* store, size_t max_msgs, size_t max_bytes);
+void free_store(MSGSTORE_T* store);
+MSG_T* get_message(MSGSTORE_T* store, size_t i);
+void drop_message(MSGSTORE_T* store);
+void free_run(MSGSTORE_T* store, MSG_T* msg);
+void trim_runs(MSGSTORE_T* store, size_t first, size_t last);
+MSG_T* reserve_message(MSGSTORE_T* store, size_t len);
+MSG_T* commit_message(MSGSTORE_T* store);
+MSG_T* adopt_message(MSGSTORE_T* store, QMSG_T* node);
+MSG_T* store_message(MSGSTORE_T* store, time_t time, int type, char* nickname,
+                     char* text, size_t len);
+
+
+//*********************************
+//        SEARCH FUNCTIONS
+//*********************************
+void free_trigrams(TRIGRAMS_T* gen);
+void free_index(MSGINDEX_T* index);
+int fold_char(int c);
+unsigned int trigram_hash(const char* s);
+void add_posting(TRIGRAMS_T* gen, unsigned int hash, unsigned long long block);
+void index_message(MSGINDEX_T* index, MSGSTORE_T* store, unsigned long long seq,
+                   MSG_T* msg);
+size_t intersect_postings(POSTINGS_T* list, unsigned long long first,
+                          unsigned long long* cands, size_t count);
+void append_candidates(SEARCH_T* s, TRIGRAMS_T* gen);
+void find_candidates(SEARCH_T* s, MSGSTORE_T* store);
+int match_message(MSG_T* msg, char* query, int len);
+int search_next(SEARCH_T* s, MSGSTORE_T* store, unsigned long long end);
+void update_search(SEARCH_T* s, MSGSTORE_T* store);
+void show_message(MSGVIEW_T* view, MSGSTORE_T* store, DWINDOW_T* win,
+                  unsigned long long seq);
+
+
+//*********************************
+//        ROSTER FUNCTIONS
+//*********************************
+void free_roster(ROSTER_T* r);
+unsigned int contact_hash(const char* key);
+CONTACT_T* find_contact(ROSTER_T* r, char* key, unsigned int hash);
+int cmp_contacts(CONTACT_T* a, CONTACT_T* b);
+size_t contact_rank(ROSTER_T* r, CONTACT_T* c);
+void grow_roster(ROSTER_T* r);
+void sort_contact(ROSTER_T* r, CONTACT_T* c);
+void unsort_contact(ROSTER_T* r, CONTACT_T* c);
+void join_contact(ROSTER_T* r, char* nickname, char* onion);
+void leave_contact(ROSTER_T* r, char* nickname, char* onion);
+void touch_roster(ROSTER_T* r);
+void scroll_roster(ROSTER_T* r, DWINDOW_T* win, int n);
+void render_roster(ROSTER_T* r, DWINDOW_T* win);
+
+
+//*********************************
+//      STATISTICS FUNCTIONS
+//*********************************
+int hist_index(long long value);
+long long hist_value(int index);
+void record_latency(HISTOGRAM_T* h, long long ns, unsigned long n);
+long long hist_percentile(HISTOGRAM_T* h, double p);
+void format_latency(long long ns, char* buf, size_t size);
+void format_hist(HISTOGRAM_T* h, char* name, char* buf, size_t size);
+void write_stats(STATS_T* stats, FILE* f);
+void render_stats(STATS_T* stats);
+
+
+//*********************************
+//       HISTORY FUNCTIONS
+//*********************************
+char* history_path();
+int open_history(HISTLOG_T* h, char* path);
+void close_history(HISTLOG_T* h);
+int rotate_history(HISTLOG_T* h);
+int valid_record(char* map, size_t end, size_t off);
+size_t history_end(char* map, size_t size);
+int load_history(HISTLOG_T* h, MSGSTORE_T* store, int w, int rows);
+void log_message(HISTLOG_T* h, MSG_T* msg);
+void commit_history(HISTLOG_T* h);
+void* th_write_history(void* ptr);
+
+
+//*********************************
+//        TRACE FUNCTIONS
+//*********************************
+int open_trace(TRACE_T* t, char* path);
+void trace_data(TRACE_T* t, int source, char* data, size_t len);
+void trace_sock(int fd, char* data, size_t len);
+void close_trace(TRACE_T* t);
+
+
 //*********************************
 //           IPC
 //*********************************
+int detect_framing(LINEBUF_T* lb, int fd);
+int read_frame(LINEBUF_T* lb, int fd, FRAME_T* f);
+int parse_line(char* line, FRAME_T* f);
 int unix_connect(char* local_path);
 int init_ipc();
+void free_unix_socks();
 void free_ipc();
 void signal_reconnect();
-void* handle_sock_inp(void* ptr);
-void* handle_sock_out(void* ptr);
-void* handle_sock_log(void* ptr);
-void* th_ipc_connector(void* ptr);
+time_t now();
+long long now_ms();
+long long now_ns();
+int connect_ipc();
+int offer_framing();
+void schedule_connect();
+void watch_sock_dir(char* path);
+void handle_inotify();
+void throttle_ipc(int on);
+void reconnect_ipc();
+QMSG_T* handle_frame(FRAME_T* f, long long recv_ns);
+void handle_sock_inp();
+void init_outq(OUTQUEUE_T* q);
+void free_outq(OUTQUEUE_T* q);
+int push_outq(OUTQUEUE_T* q, char* msg, size_t len);
+int flush_outq(OUTQUEUE_T* q, int fd);
+void flush_sock_out();
+int handle_sock_out(char* msg, size_t len);
+void handle_sock_log();
+void run_event_loop();
 
 
 #endif
@@ -0,0 +1,179 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Buffered line reader of the UI unix sockets.
+ * Shared by dchat-gui and dchat-bench, so that the benchmark measures
+ * the reader the GUI uses.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "dchat-linebuf.h"
+
+
+/**
+ *  Initializes a buffered line reader.
+ *  The buffer of the reader will be allocated on the first read.
+ *  @param lb      Pointer to line reader structure
+ *  @param on_read Function called with every chunk of data read, NULL for none
+ */
+void
+init_linebuf(LINEBUF_T* lb, void (*on_read)(int fd, char* data, size_t len))
+{
+    memset(lb, 0, sizeof(*lb));
+    lb->on_read = on_read;
+}
+
+
+/**
+ *  Frees the buffer of a buffered line reader.
+ *  The reader can be used again afterwards, keeping its read callback.
+ *  @param lb Pointer to line reader structure
+ */
+void
+free_linebuf(LINEBUF_T* lb)
+{
+    free(lb->buf);
+    init_linebuf(lb, lb->on_read);
+}
+
+
+/**
+ *  Reads a chunk of data from a file descriptor into a line reader.
+ *  Data not handed out yet is moved to the beginning of the buffer first.
+ *  @param lb   Pointer to line reader structure of the file descriptor
+ *  @param fd   File descriptor to read from
+ *  @param need Number of bytes the buffer has to be able to hold
+ *  @return number of bytes read, 0 on EOF, -1 on error
+ */
+int
+fill_linebuf(LINEBUF_T* lb, int fd, size_t need)
+{
+    char* alc_ptr;         // used for realloc
+    size_t size;           // new size of buffer
+    ssize_t ret;           // return value of read
+
+    // move remaining partial data to the beginning of the buffer
+    if (lb->start > 0)
+    {
+        memmove(lb->buf, lb->buf + lb->start, lb->end - lb->start);
+        lb->end  -= lb->start;
+        lb->start = 0;
+    }
+
+    // enlarge buffer if there is not enough space for another chunk
+    // or the data needed
+    if (lb->size - lb->end < LINEBUF_CHUNK || lb->size < need)
+    {
+        size = lb->size > 0 ? lb->size * 2 : LINEBUF_CHUNK;
+
+        while (size < need)
+        {
+            size *= 2;
+        }
+
+        alc_ptr = realloc(lb->buf, size);
+
+        if (alc_ptr == NULL)
+        {
+            free_linebuf(lb);
+            exit(1);
+        }
+
+        lb->buf  = alc_ptr;
+        lb->size = size;
+    }
+
+    if ((ret = read(fd, lb->buf + lb->end, lb->size - lb->end)) > 0)
+    {
+        if (lb->on_read != NULL)
+        {
+            lb->on_read(fd, lb->buf + lb->end, ret);
+        }
+
+        lb->end += ret;
+    }
+
+    return ret;
+}
+
+
+/**
+ *  Read a line terminated with \\n from a file descriptor.
+ *  Data is read in chunks of at least LINEBUF_CHUNK bytes into the buffer
+ *  of the given line reader. Complete lines are handed out directly from
+ *  this buffer, so only one read() is required for many lines.
+ *  @param lb   Pointer to line reader structure of the file descriptor
+ *  @param fd   File descriptor to read from
+ *  @param line Will point to the line within the buffer of the line reader.
+ *              The line is \\0 terminated and remains valid until the
+ *              next call of this function.
+ *  @return: length of bytes read (including \\n), 0 on EOF, -1 on error
+ *           (errno EPROTO if the line exceeds LINEBUF_MAX)
+ */
+int
+read_line(LINEBUF_T* lb, int fd, char** line)
+{
+    char* nl = NULL;       // pointer to next newline within buffer
+    size_t len;            // length of line
+    int ret;               // return value of read
+    *line = NULL;
+
+    if (lb->buf != NULL)
+    {
+        nl = memchr(lb->buf + lb->start, '\n', lb->end - lb->start);
+    }
+
+    while (nl == NULL)
+    {
+        // a peer never terminating its line must not exhaust memory
+        if (lb->end - lb->start >= LINEBUF_MAX)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+
+        // on error or EOF of read
+        if ((ret = fill_linebuf(lb, fd, 0)) <= 0)
+        {
+            return ret;
+        }
+
+        // only search the newly read bytes for a newline
+        nl = memchr(lb->buf + lb->end - ret, '\n', ret);
+    }
+
+    // terminate string
+    *nl   = '\0';
+    *line = lb->buf + lb->start;
+    len   = nl - *line;
+    lb->start += len + 1;
+    return len + 1; // length of bytes read including \n
+}
@@ -0,0 +1,62 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DCHAT_LINEBUF_H
+#define DCHAT_LINEBUF_H
+
+#include <stddef.h>
+
+
+//*********************************
+//        LINEBUF SETTINGS
+//*********************************
+#define LINEBUF_CHUNK 4096        // minimum number of bytes read at once from a socket
+#define LINEBUF_MAX   (1024*1024) // maximum length of a text line
+
+
+//*********************************
+//         STRUCTURES
+//*********************************
+
+/*!
+ * Buffered line reader.
+ * Holds data read in chunks from a file descriptor
+ * that has not been handed out as line yet.
+ */
+typedef struct LINEBUF
+{
+    char*  buf;   //!< Buffer containing data read from file descriptor
+    size_t size;  //!< Allocated size of buffer
+    size_t start; //!< Offset of first byte not handed out yet
+    size_t end;   //!< Offset behind the last byte read
+    void (*on_read)(int fd, char* data, size_t len); //!< Called with every chunk read, may be NULL
+} LINEBUF_T;
+
+
+//*********************************
+//        LINEBUF FUNCTIONS
+//*********************************
+void init_linebuf(LINEBUF_T* lb, void (*on_read)(int fd, char* data, size_t len));
+void free_linebuf(LINEBUF_T* lb);
+int fill_linebuf(LINEBUF_T* lb, int fd, size_t need);
+int read_line(LINEBUF_T* lb, int fd, char** line);
+
+
+#endif